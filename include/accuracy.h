@@ -0,0 +1,107 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_ACCURACY_H
+#define OCMESH_ACCURACY_H
+
+#include "csg.h"
+#include "octree.h"
+
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+
+/*
+ * Options for accuracy_report
+ */
+struct accuracy_options
+{
+    // Number of random points
+    size_t samples = size_t(1) << 22;
+    
+    // Seed of the random points, so that reports can be reproduced
+    uint64_t seed = 1;
+    
+    // Number of threads. Zero means one for each hardware thread.
+    unsigned threads = 0;
+};
+
+/*
+ * Statistical estimate of how well an octree represents the scene it was
+ * built from.
+ *
+ * Random cells of the finest level are located in the octree in batches,
+ * with the batched octree::locate(), and the material of the leaf found
+ * is compared with the one given by the signs of the distance functions
+ * of the scene at the center of the cell. Batches are processed in
+ * parallel, each one with its own random generator.
+ *
+ * Errors are counted for each material the points should have, and
+ * separately for the points near a boundary, that is, closer to the
+ * boundary of any object of the scene than the diagonal of the smallest
+ * leaves. With a correct build, only these points can be misclassified.
+ */
+class accuracy_report
+{
+public:
+    struct counts {
+        size_t samples = 0;
+        size_t misclassified = 0;
+        
+        double rate() const {
+            return samples ? double(misclassified) / samples : 0;
+        }
+    };
+    
+    struct material {
+        voxel::material_t id;
+        counts all;
+        counts boundary; // Points near a boundary
+    };
+    
+    accuracy_report(octree const&oc, csg::scene const&scene,
+                    accuracy_options const&options = accuracy_options());
+    
+    counts const&total() const { return _total; }
+    counts const&boundary() const { return _boundary; }
+    
+    // Sorted by material
+    std::vector<material> const&materials() const { return _materials; }
+    
+    /*
+     * Writes the report as a JSON object, with the total and boundary
+     * counts and rates, and a "materials" array with the same for each
+     * material
+     */
+    void write_json(std::ostream &out) const;
+    
+private:
+    counts _total;
+    counts _boundary;
+    std::vector<material> _materials;
+};
+    
+} // namespace details
+
+using details::accuracy_options;
+using details::accuracy_report;
+
+} // namespace ocmesh
+
+#endif
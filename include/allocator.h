@@ -0,0 +1,184 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_ALLOCATOR_H
+#define OCMESH_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <utility>
+#include <type_traits>
+
+#include <sys/mman.h>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Allocator used for the storage of the octree.
+ *
+ * It differs from std::allocator in two ways:
+ * - It can be asked to back large blocks with huge pages, to reduce TLB
+ *   misses while scanning or searching big octrees. Blocks above the
+ *   threshold are then mapped directly and advised with MADV_HUGEPAGE
+ *   where supported.
+ * - An allocator made by uninitialized() skips the value-initialization
+ *   of trivially copyable elements, so resizing a vector doesn't touch the
+ *   memory. The pages of the octree are then first touched by the threads
+ *   that fill them, which on NUMA systems places them on the node of the
+ *   thread that produced the data. Since this allocator compares equal to
+ *   the normal one, the vector can then take back the normal one with the
+ *   allocator-extended move constructor, without copying anything, so that
+ *   any further growth is value-initialized as usual.
+ */
+template<typename T>
+class octree_allocator
+{
+public:
+    using value_type = T;
+    
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+    
+    static constexpr size_t huge_page_size = size_t(2) << 20;
+    
+    octree_allocator() = default;
+    explicit octree_allocator(bool huge_pages) : _huge_pages(huge_pages) { }
+    
+    template<typename U>
+    octree_allocator(octree_allocator<U> const&other)
+        : _huge_pages(other.huge_pages()) { }
+    
+    static octree_allocator uninitialized(bool huge_pages) {
+        octree_allocator allocator(huge_pages);
+        allocator._uninitialized = true;
+        return allocator;
+    }
+    
+    bool huge_pages() const { return _huge_pages; }
+    
+    T *allocate(size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        
+        if(!mapped(bytes)) {
+            void *p = std::malloc(bytes);
+            if(!p)
+                throw std::bad_alloc();
+            return static_cast<T *>(p);
+        }
+        
+        void *p = mmap(nullptr, rounded(bytes), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        madvise(p, rounded(bytes), MADV_HUGEPAGE);
+#endif
+        return static_cast<T *>(p);
+    }
+    
+    void deallocate(T *p, size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        
+        if(mapped(bytes))
+            munmap(p, rounded(bytes));
+        else
+            std::free(p);
+    }
+    
+    template<typename U, typename ...Args>
+    void construct(U *p, Args&& ...args) {
+        ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+    
+    template<typename U>
+    void construct(U *p) {
+        if(!_uninitialized || !std::is_trivially_copyable<U>::value)
+            ::new(static_cast<void *>(p)) U();
+    }
+    
+    template<typename U>
+    void destroy(U *p) { p->~U(); }
+    
+    /*
+     * Bytes of the mapping that contains the given address which are
+     * actually backed by transparent huge pages, as reported by the kernel
+     * in /proc/self/smaps. Asking for huge pages is only advice, so this is
+     * the way to know whether it was followed. Zero if it's not known.
+     */
+    static size_t huge_page_bytes(void const *p)
+    {
+        std::ifstream smaps("/proc/self/smaps");
+        uintptr_t address = reinterpret_cast<uintptr_t>(p);
+        
+        bool inside = false;
+        std::string line;
+        while(std::getline(smaps, line)) {
+            // Header of a mapping: "start-end perms offset ..."
+            char *end;
+            unsigned long long first = std::strtoull(line.c_str(), &end, 16);
+            if(end != line.c_str() && *end == '-') {
+                unsigned long long last = std::strtoull(end + 1, &end, 16);
+                if(*end == ' ') {
+                    inside = address >= first && address < last;
+                    continue;
+                }
+            }
+            
+            if(inside && line.compare(0, 14, "AnonHugePages:") == 0)
+                return size_t(std::strtoull(line.c_str() + 14, nullptr, 10))
+                       * 1024;
+        }
+        
+        return 0;
+    }
+    
+private:
+    bool mapped(size_t bytes) const {
+        return _huge_pages && bytes >= huge_page_size;
+    }
+    
+    static size_t rounded(size_t bytes) {
+        return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+    }
+    
+private:
+    bool _huge_pages = false;
+    bool _uninitialized = false;
+};
+
+template<typename T, typename U>
+bool operator==(octree_allocator<T> const&a, octree_allocator<U> const&b) {
+    return a.huge_pages() == b.huge_pages();
+}
+
+template<typename T, typename U>
+bool operator!=(octree_allocator<T> const&a, octree_allocator<U> const&b) {
+    return !(a == b);
+}
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
@@ -0,0 +1,91 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_AMR_H
+#define OCMESH_AMR_H
+
+#include "octree.h"
+
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Block-structured view of an octree, for AMR solvers that work on
+ * uniform patches instead of single leaves.
+ *
+ * The leaves of each level are grouped in bricks: cubes aligned to their
+ * own size, made of leaves of the same level only. Since such a cube
+ * corresponds to a node of the octree, its leaves are contiguous in
+ * Morton order, and can be found with a single pass over the leaves of
+ * the level, taking at each step the largest brick starting there.
+ *
+ * Each patch stores its level, its origin and dimensions in cells of its
+ * level, and the position of its first cell in the materials array.
+ * Materials of a patch are stored with x varying fastest, then y, then z.
+ *
+ * Leaves of every material are grouped, void ones included, so in a dense
+ * octree the patches of all levels cover the whole domain. In a sparse
+ * octree, missing ranges are not covered by any patch.
+ */
+class amr_patches
+{
+public:
+    struct patch {
+        voxel::level_t level;
+        glm::u32vec3 origin;
+        glm::u32vec3 dims;
+        size_t first;
+    };
+    
+    amr_patches() = default;
+    
+    /*
+     * Bricks have at most 2^max_log_size cells per side
+     */
+    explicit amr_patches(octree const&oc, uint8_t max_log_size = 4);
+    
+    std::vector<patch> const&patches() const { return _patches; }
+    std::vector<voxel::material_t> const&materials() const {
+        return _materials;
+    }
+    
+    /*
+     * Writes the patches as raw binary data, in native byte order:
+     *
+     *     patches (uint64), cells (uint64),
+     *     for each patch:
+     *         level (uint32), origin (3 x uint32), dims (3 x uint32),
+     *         first (uint64),
+     *     materials (cells x uint32)
+     */
+    bool write(std::ostream &out) const;
+    
+private:
+    std::vector<patch> _patches;
+    std::vector<voxel::material_t> _materials;
+};
+    
+} // namespace details
+
+using details::amr_patches;
+
+} // namespace ocmesh
+
+#endif
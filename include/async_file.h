@@ -0,0 +1,139 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_ASYNC_FILE_H
+#define OCMESH_ASYNC_FILE_H
+
+#include <std14/memory>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Stream buffer that writes to a file asynchronously.
+ *
+ * Output is formatted into one of two large buffers. When it's full, the
+ * buffer is submitted to the kernel and formatting continues into the other
+ * one, so the exporters never wait for the disk unless it's slower than
+ * them. Writes go through io_uring when the kernel supports it, and through
+ * pwrite() on a dedicated writer thread otherwise.
+ *
+ * sync() waits for all the pending writes, so flushing the stream often
+ * defeats the purpose.
+ */
+class async_filebuf : public std::streambuf
+{
+public:
+    static constexpr size_t default_buffer_size = size_t(4) << 20;
+    
+    /*
+     * The mechanism used to write the buffers out
+     */
+    class backend
+    {
+    public:
+        virtual ~backend();
+        
+        // Starts writing the given buffer slot, without waiting
+        virtual bool submit(unsigned slot, char const *data, size_t size,
+                            uint64_t offset) = 0;
+        
+        // Waits for the write of the given slot, if any
+        virtual bool wait(unsigned slot) = 0;
+    };
+    
+    async_filebuf() = default;
+    ~async_filebuf();
+    
+    async_filebuf(async_filebuf const&) = delete;
+    async_filebuf &operator=(async_filebuf const&) = delete;
+    
+    bool open(std::string const&path,
+              size_t buffer_size = default_buffer_size);
+    bool close();
+    
+    bool is_open() const { return _fd >= 0; }
+    
+    // True if the writes are submitted through io_uring
+    bool uses_io_uring() const { return _io_uring; }
+    
+protected:
+    int_type overflow(int_type c) override;
+    int sync() override;
+    
+private:
+    bool flip();
+    bool drain();
+    
+    int _fd = -1;
+    bool _io_uring = false;
+    bool _failed = false;
+    
+    std::unique_ptr<backend> _backend;
+    std::vector<char> _buffers[2];
+    unsigned _current = 0;
+    uint64_t _offset = 0;
+};
+
+/*
+ * Output file stream on top of async_filebuf, to be passed to the exporters
+ * in place of a std::ofstream.
+ */
+class async_ofstream : public std::ostream
+{
+public:
+    async_ofstream() : std::ostream(&_buf) { }
+    
+    explicit async_ofstream(std::string const&path)
+        : std::ostream(&_buf)
+    {
+        open(path);
+    }
+    
+    void open(std::string const&path) {
+        if(!_buf.open(path))
+            setstate(failbit);
+    }
+    
+    void close() {
+        if(!_buf.close())
+            setstate(failbit);
+    }
+    
+    bool is_open() const { return _buf.is_open(); }
+    
+    async_filebuf *rdbuf() const {
+        return const_cast<async_filebuf *>(&_buf);
+    }
+    
+private:
+    async_filebuf _buf;
+};
+    
+} // namespace details
+
+using details::async_filebuf;
+using details::async_ofstream;
+
+} // namespace ocmesh
+
+#endif
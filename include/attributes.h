@@ -0,0 +1,189 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_ATTRIBUTES_H
+#define OCMESH_ATTRIBUTES_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+
+/*
+ * Conversions between float and IEEE 754 half precision, with rounding to
+ * nearest even. Values too large for half precision become infinities.
+ */
+inline uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    
+    uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    
+    if(exponent == 0xff) // Infinities and NaNs
+        return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    
+    int e = int(exponent) - 127 + 15;
+    if(e >= 31)
+        return uint16_t(sign | 0x7c00);
+    
+    if(e <= 0) { // Subnormals, or zero
+        if(e < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = uint32_t(14 - e);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((uint32_t(1) << shift) - 1);
+        uint32_t middle = uint32_t(1) << (shift - 1);
+        if(rest > middle || (rest == middle && (half & 1)))
+            ++half;
+        return uint16_t(sign | half);
+    }
+    
+    uint32_t half = (uint32_t(e) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half; // May carry into the exponent, up to the infinity
+    
+    return uint16_t(sign | half);
+}
+
+inline float half_to_float(uint16_t value)
+{
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    
+    uint32_t bits;
+    if(exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if(exponent != 0)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else if(mantissa == 0)
+        bits = sign;
+    else { // Subnormal, normalized in single precision
+        exponent = 127 - 15 + 1;
+        while(!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+/*
+ * A named array of values attached to the leaves of an octree, with a
+ * fixed number of components for each leaf, stored contiguously in leaf
+ * order. Values can be stored in single or half precision, to halve the
+ * memory needed by attributes that don't need the full precision.
+ */
+class leaf_attribute
+{
+public:
+    enum format_t {
+        float16,
+        float32
+    };
+    
+    leaf_attribute(std::string name, size_t leaves, unsigned components = 1,
+                   format_t format = float32)
+        : _name(std::move(name)), _leaves(leaves), _components(components),
+          _format(format)
+    {
+        if(format == float16)
+            _half.resize(leaves * components);
+        else
+            _single.resize(leaves * components);
+    }
+    
+    std::string const&name() const { return _name; }
+    format_t format() const { return _format; }
+    unsigned components() const { return _components; }
+    
+    // Number of leaves
+    size_t size() const { return _leaves; }
+    
+    float get(size_t leaf, unsigned component = 0) const {
+        assert(leaf < _leaves && component < _components);
+        size_t i = leaf * _components + component;
+        return _format == float16 ? half_to_float(_half[i]) : _single[i];
+    }
+    
+    void set(size_t leaf, unsigned component, float value) {
+        assert(leaf < _leaves && component < _components);
+        size_t i = leaf * _components + component;
+        if(_format == float16)
+            _half[i] = float_to_half(value);
+        else
+            _single[i] = value;
+    }
+    
+    void set(size_t leaf, float value) { set(leaf, 0, value); }
+    
+    /*
+     * Keeps only the values of the leaves for which the predicate,
+     * called with the leaf index, returns true
+     */
+    template<typename F>
+    void compact(F const&keep) {
+        size_t kept = 0;
+        for(size_t leaf = 0; leaf < _leaves; ++leaf) {
+            if(!keep(leaf))
+                continue;
+            for(unsigned c = 0; c < _components; ++c) {
+                size_t from = leaf * _components + c;
+                size_t to = kept * _components + c;
+                if(_format == float16)
+                    _half[to] = _half[from];
+                else
+                    _single[to] = _single[from];
+            }
+            ++kept;
+        }
+        
+        _leaves = kept;
+        _half.resize(_format == float16 ? kept * _components : 0);
+        _single.resize(_format == float32 ? kept * _components : 0);
+    }
+    
+private:
+    std::string _name;
+    size_t _leaves;
+    unsigned _components;
+    format_t _format;
+    
+    std::vector<uint16_t> _half;
+    std::vector<float> _single;
+};
+    
+} // namespace details
+
+using details::leaf_attribute;
+
+} // namespace ocmesh
+
+#endif
@@ -0,0 +1,119 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_BOUNDED_QUEUE_H
+#define OCMESH_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * A blocking FIFO queue with a maximum capacity, to connect the stages of a
+ * pipeline. Producers block when the queue is full, so a fast producer
+ * can't make the memory usage grow without bounds. When the producer is
+ * done it closes the queue, and consumers then drain it. A consumer that
+ * gives up early aborts the queue instead, which releases the producers.
+ */
+template<typename T>
+class bounded_queue
+{
+public:
+    explicit bounded_queue(size_t capacity) : _capacity(capacity) { }
+    
+    bounded_queue(bounded_queue const&) = delete;
+    bounded_queue &operator=(bounded_queue const&) = delete;
+    
+    /*
+     * Returns false, without pushing anything, if the queue was aborted
+     */
+    bool push(T value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [&] {
+            return _items.size() < _capacity || _aborted;
+        });
+        
+        if(_aborted)
+            return false;
+        
+        _items.push_back(std::move(value));
+        _not_empty.notify_one();
+        
+        return true;
+    }
+    
+    /*
+     * Returns false if the queue is closed and there's nothing left, or if
+     * it was aborted
+     */
+    bool pop(T &value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [&] {
+            return !_items.empty() || _closed || _aborted;
+        });
+        
+        if(_items.empty() || _aborted)
+            return false;
+        
+        value = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        
+        return true;
+    }
+    
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+    }
+    
+    /*
+     * Drops the queued items and makes every pending and future push() and
+     * pop() return false at once
+     */
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        _items.clear();
+        _not_full.notify_all();
+        _not_empty.notify_all();
+    }
+    
+private:
+    size_t _capacity;
+    bool _closed = false;
+    bool _aborted = false;
+    std::deque<T> _items;
+    
+    std::mutex _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+};
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
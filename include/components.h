@@ -0,0 +1,112 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_COMPONENTS_H
+#define OCMESH_COMPONENTS_H
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+
+/*
+ * Connected components of each material of an octree, void included,
+ * where two leaves are connected if they share a part of a face. They
+ * show the leaks of the model, the fragments detached from the rest of
+ * their material, and the cavities of void enclosed by other materials,
+ * which make solvers fail long after the mesh has been exported.
+ *
+ * Components are found with a lock-free union-find over the leaves: each
+ * parallel task visits the leaves across the positive faces of a range of
+ * leaves, and merges their sets with compare-and-swap, always linking the
+ * root with the larger index to the other one. Path halving keeps the
+ * trees shallow. In a sparse octree, the missing ranges are split into
+ * the largest Morton-aligned cubes of void, which take part in the
+ * union-find like leaves, so void components are found in sparse octrees
+ * too.
+ *
+ * Volumes are in base cells. Components are numbered in the order of
+ * their first leaf.
+ */
+class material_components
+{
+public:
+    struct component {
+        voxel::material_t material;
+        size_t leaves;   // Leaves of the octree, so none for sparse void
+        uint64_t volume;
+        bool border;     // Touches the border of the domain
+    };
+    
+    material_components() = default;
+    
+    explicit material_components(octree const&oc,
+                                 unsigned threads = concurrency());
+    
+    std::vector<component> const&components() const { return _components; }
+    
+    // Component of each leaf of the octree, in the order of the leaves
+    std::vector<size_t> const&labels() const { return _labels; }
+    
+    // Number of components of the given material
+    size_t count(voxel::material_t material) const;
+    
+    // Void components that don't touch the border of the domain
+    std::vector<size_t> cavities() const;
+    
+    /*
+     * Writes a JSON object with a "materials" array, with the number of
+     * components of each material and of the ones not touching the border,
+     * and a "components" array with the fields above
+     */
+    void write_json(std::ostream &out) const;
+    
+private:
+    std::vector<component> _components;
+    std::vector<size_t> _labels;
+};
+
+/*
+ * Drops the components smaller than the given volume, before exporting a
+ * mesh: their leaves take the material of the neighbouring component
+ * that shares the largest area with them, among the ones that are kept.
+ * Small components surrounded only by other small ones are resolved
+ * after them, outwards from the kept ones, and take what they become.
+ * Only the ones that can't reach any kept component become void. Small
+ * cavities are filled in this way, and small fragments merge with what
+ * surrounds them.
+ *
+ * The components must be the current ones of the octree. In a sparse
+ * octree, void components have no leaves to fill, so they're kept, and
+ * the leaves that become void are dropped. Returns the number of leaves
+ * that changed material.
+ */
+size_t drop_fragments(octree &oc, material_components const&components,
+                      uint64_t min_volume);
+    
+} // namespace details
+
+using details::material_components;
+using details::drop_fragments;
+
+} // namespace ocmesh
+
+#endif
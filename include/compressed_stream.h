@@ -0,0 +1,125 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_COMPRESSED_STREAM_H
+#define OCMESH_COMPRESSED_STREAM_H
+
+#ifdef OCMESH_HAVE_ZLIB
+
+#include "parallel.h"
+
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Stream buffer that compresses everything written to it, on multiple
+ * threads, before passing it to another stream.
+ *
+ * The input is cut in blocks that are deflated independently, in batches
+ * of a few blocks per thread. Each block is primed with the last 32K of
+ * the previous one, and ends with a sync flush, so the compressed blocks
+ * can be simply concatenated into a single valid deflate stream, with
+ * about the same ratio of a serial compression. The checksums of the
+ * blocks are combined in order. This is the same scheme used by pigz.
+ *
+ * The stream is completed by finish(), or by the destructor.
+ */
+class compressed_streambuf : public std::streambuf
+{
+public:
+    enum format_t {
+        gzip, // RFC 1952, what the gzip tool reads and writes
+        zlib  // RFC 1950
+    };
+    
+    static constexpr size_t default_block_size = size_t(128) << 10;
+    
+    explicit compressed_streambuf(std::ostream &out,
+                                  format_t format = gzip,
+                                  int level = 6,
+                                  unsigned threads = concurrency(),
+                                  size_t block_size = default_block_size);
+    ~compressed_streambuf();
+    
+    compressed_streambuf(compressed_streambuf const&) = delete;
+    compressed_streambuf &operator=(compressed_streambuf const&) = delete;
+    
+    /*
+     * Compresses the remaining data and writes the trailer of the stream.
+     * Nothing can be written afterwards.
+     */
+    bool finish();
+    
+protected:
+    int_type overflow(int_type c) override;
+    
+private:
+    bool compress_batch();
+    void header();
+    void trailer();
+    
+    std::ostream &_out;
+    format_t _format;
+    int _level;
+    unsigned _threads;
+    size_t _block_size;
+    bool _finished = false;
+    
+    std::vector<char> _input;      // A batch of uncompressed blocks
+    std::vector<char> _dictionary; // Tail of the last block of the batch
+    
+    uint32_t _check = 0;           // crc32 or adler32 of the whole input
+    uint64_t _length = 0;
+};
+
+/*
+ * Output stream that writes compressed data to another stream, typically a
+ * file stream opened in binary mode.
+ */
+class compressed_ostream : public std::ostream
+{
+public:
+    explicit compressed_ostream(
+        std::ostream &out,
+        compressed_streambuf::format_t format = compressed_streambuf::gzip,
+        int level = 6, unsigned threads = concurrency())
+        : std::ostream(&_buf), _buf(out, format, level, threads) { }
+    
+    void finish() {
+        if(!_buf.finish())
+            setstate(badbit);
+    }
+    
+private:
+    compressed_streambuf _buf;
+};
+    
+} // namespace details
+
+using details::compressed_streambuf;
+using details::compressed_ostream;
+
+} // namespace ocmesh
+
+#endif // OCMESH_HAVE_ZLIB
+
+#endif
@@ -51,6 +51,16 @@ namespace details {
         virtual float distance(glm::vec3 const& from) = 0;
         virtual class bounding_box bounding_box() const = 0;
         
+        /*
+         * Batched version of distance(), computing the distances of count
+         * points at once. The default implementation calls distance() for
+         * each point. Nodes override it with plain loops over the whole
+         * batch, which the compiler can vectorize, so that we pay a single
+         * virtual call per batch instead of one per point.
+         */
+        virtual void distances(glm::vec3 const *from, float *result,
+                               size_t count);
+        
         virtual void dump(std::ostream &) const = 0;
     };
 
@@ -68,6 +78,8 @@ namespace details {
         float radius() const { return _radius; }
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
@@ -84,6 +96,8 @@ namespace details {
         float side() const { return _side; }
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
@@ -106,6 +120,8 @@ namespace details {
         voxel::material_t material() const { return _material; }
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
@@ -280,6 +296,8 @@ namespace details {
         using binary_operation_t::binary_operation_t;
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
@@ -290,6 +308,8 @@ namespace details {
         using binary_operation_t::binary_operation_t;
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
@@ -300,6 +320,8 @@ namespace details {
         using binary_operation_t::binary_operation_t;
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
@@ -323,6 +345,8 @@ namespace details {
         glm::mat4 const&world_to_object() const { return _world_to_object; }
         
         float distance(glm::vec3 const& from) override;
+        void distances(glm::vec3 const *from, float *result,
+                       size_t count) override;
         class bounding_box bounding_box() const override;
         
         void dump(std::ostream &) const override;
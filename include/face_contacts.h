@@ -0,0 +1,134 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_FACE_CONTACTS_H
+#define OCMESH_FACE_CONTACTS_H
+
+#include "octree.h"
+
+#include <algorithm>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * A part of a face of a leaf, together with what lies across it.
+ *
+ * If the neighbour is as large as the leaf or larger, the part is the
+ * whole face, otherwise it's the face of the smaller neighbour. The
+ * neighbour is end() when there's nothing across the face, i.e. outside
+ * of the domain or in a missing range of a sparse octree.
+ */
+struct face_contact
+{
+    voxel::face side;
+    octree::const_iterator neighbour;
+    glm::u32vec3 origin; // Minimum corner of the part of the face
+    uint32_t size;
+};
+
+/*
+ * Calls f(face_contact) for every leaf touching each of the faces of the
+ * given leaf. The region across each face is visited top-down, going down
+ * only where it's subdivided.
+ */
+template<typename F>
+void for_each_contact(octree const&oc, octree::const_iterator leaf,
+                      F const&f);
+
+namespace contacts {
+    
+    template<typename F>
+    void visit(octree const&oc, voxel::face side, glm::u32vec3 cube,
+               voxel::level_t level, F const&f)
+    {
+        uint8_t axis = side / 2;
+        bool positive = side % 2;
+        uint32_t size = uint32_t(1) << (voxel::max_level - level);
+        
+        glm::u32vec3 origin = cube;
+        origin[axis] = positive ? cube[axis] : cube[axis] + size;
+        
+        auto it = oc.locate(glm::u16vec3(cube));
+        
+        if(it != oc.end() && it->level() <= level) {
+            f(face_contact{ side, it, origin, size });
+            return;
+        }
+        
+        // Nothing at all in the cube: a gap of a sparse octree
+        if(it == oc.end()) {
+            uint64_t m = morton(cube);
+            uint64_t span = uint64_t(1) << (3 * (voxel::max_level - level));
+            auto next = std::lower_bound(oc.begin(), oc.end(),
+                                         voxel(m, 0, 0));
+            
+            if(next == oc.end() || next->morton() >= m + span) {
+                f(face_contact{ side, oc.end(), origin, size });
+                return;
+            }
+        }
+        
+        // The cube is subdivided: go down to the half facing the leaf
+        uint32_t half = size / 2;
+        uint8_t u = (axis + 1) % 3, w = (axis + 2) % 3;
+        
+        for(uint32_t i = 0; i < 4; ++i) {
+            glm::u32vec3 child = cube;
+            child[axis] += positive ? 0 : half;
+            child[u] += (i & 1) * half;
+            child[w] += (i >> 1) * half;
+            
+            visit(oc, side, child, voxel::level_t(level + 1), f);
+        }
+    }
+    
+} // namespace contacts
+
+template<typename F>
+void for_each_contact(octree const&oc, octree::const_iterator leaf,
+                      F const&f)
+{
+    glm::u32vec3 origin(leaf->coordinates());
+    uint32_t size = leaf->size();
+    
+    for(uint8_t s = 0; s < 6; ++s) {
+        voxel::face side = voxel::face(s);
+        uint8_t axis = s / 2;
+        bool positive = s % 2;
+        
+        uint32_t plane = origin[axis] + (positive ? size : 0);
+        bool outside = positive ? plane > voxel::max_coordinate : plane == 0;
+        
+        if(outside) {
+            glm::u32vec3 face = origin;
+            face[axis] = plane;
+            f(face_contact{ side, oc.end(), face, size });
+            continue;
+        }
+        
+        glm::u32vec3 cube = origin;
+        cube[axis] = positive ? plane : plane - size;
+        
+        contacts::visit(oc, side, cube, leaf->level(), f);
+    }
+}
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
@@ -0,0 +1,150 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_HEX_MESH_H
+#define OCMESH_HEX_MESH_H
+
+#include "octree.h"
+
+#include <array>
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * In-memory hexahedral mesh of the solid leaves of an octree, for
+ * applications that want to hand the mesh to their solvers directly,
+ * instead of going through a file.
+ *
+ * Everything is stored in flat, contiguous arrays:
+ *
+ * - the coordinates of the nodes, three per node, expressed in the same
+ *   integer coordinate space of the voxels;
+ * - the connectivity, eight node indexes per element, with the usual
+ *   ordering of VTK and Gmsh: the back face counterclockwise, then the
+ *   front face;
+ * - the material of each element.
+ *
+ * Elements are the solid leaves in Morton order, and the corners shared by
+ * adjacent leaves are merged into single nodes, sorted in Morton order as
+ * well. Hanging nodes are left as they are.
+ *
+ * Optionally, the mesh also lists the boundary faces, i.e. the faces of
+ * the elements that touch void or the outside of the domain, also if only
+ * in part. Their nodes are given counterclockwise when seen from outside.
+ *
+ * Also optionally, the mesh computes the node adjacency needed to assemble
+ * finite element matrices, as a CSR sparsity pattern. Hanging nodes, i.e.
+ * nodes lying on an edge or a face of a larger element, are constrained
+ * to the nodes of that edge or face, and the constraints are folded into
+ * the pattern: each element couples the nodes it actually depends on, and
+ * the rows of the hanging nodes only have the diagonal entry.
+ */
+struct hex_mesh_options
+{
+    // List the boundary faces
+    bool boundary = false;
+    
+    // Compute the hanging node constraints and the node adjacency
+    bool adjacency = false;
+};
+
+class hex_mesh
+{
+public:
+    struct boundary_face {
+        size_t element;
+        voxel::face side;
+        std::array<uint64_t, 4> nodes;
+    };
+    
+    /*
+     * The value of the hanging node nodes[i] is the combination of the
+     * values of masters[k] with weights[k], for k in [offsets[i],
+     * offsets[i + 1]). Masters are never hanging nodes themselves: chains
+     * of constraints are already resolved.
+     */
+    struct constraints_t {
+        std::vector<uint64_t> nodes;
+        std::vector<uint64_t> offsets;
+        std::vector<uint64_t> masters;
+        std::vector<double> weights;
+    };
+    
+    /*
+     * The columns of row i are columns[k] for k in [offsets[i],
+     * offsets[i + 1]), sorted
+     */
+    struct adjacency_t {
+        std::vector<uint64_t> offsets;
+        std::vector<uint64_t> columns;
+    };
+    
+    hex_mesh() = default;
+    explicit hex_mesh(octree const&oc, bool boundary = false);
+    hex_mesh(octree const&oc, hex_mesh_options const&options);
+    
+    size_t nodes() const { return _coordinates.size() / 3; }
+    size_t elements() const { return _materials.size(); }
+    
+    std::vector<double> const&coordinates() const { return _coordinates; }
+    std::vector<uint64_t> const&connectivity() const { return _connectivity; }
+    std::vector<voxel::material_t> const&materials() const {
+        return _materials;
+    }
+    
+    // These are empty unless requested at construction
+    std::vector<boundary_face> const&boundary() const { return _boundary; }
+    constraints_t const&constraints() const { return _constraints; }
+    adjacency_t const&adjacency() const { return _adjacency; }
+    
+    /*
+     * Writes the adjacency and the constraints as raw binary arrays, in
+     * native byte order. Counts and indexes are 64-bit unsigned integers,
+     * weights are doubles:
+     *
+     *     rows, entries, offsets[rows + 1], columns[entries],
+     *     hanging, nodes[hanging], offsets[hanging + 1],
+     *     masters[offsets[hanging]], weights[offsets[hanging]]
+     */
+    bool write_adjacency(std::ostream &out) const;
+    
+private:
+    void find_boundary(octree const&oc, std::vector<size_t> const&leaves);
+    void find_constraints(octree const&oc, std::vector<size_t> const&leaves,
+                          std::vector<uint64_t> const&keys);
+    void find_adjacency();
+    
+private:
+    std::vector<double> _coordinates;
+    std::vector<uint64_t> _connectivity;
+    std::vector<voxel::material_t> _materials;
+    std::vector<boundary_face> _boundary;
+    constraints_t _constraints;
+    adjacency_t _adjacency;
+};
+    
+} // namespace details
+
+using details::hex_mesh;
+using details::hex_mesh_options;
+
+} // namespace ocmesh
+
+#endif
@@ -0,0 +1,126 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_HEXAHEDRA_H
+#define OCMESH_HEXAHEDRA_H
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Order of the nodes of a hexahedral element, as used by VTK, Gmsh and most
+ * finite element codes: the back face counterclockwise, then the front one.
+ * voxel::corners() instead returns the corners in Morton order.
+ */
+constexpr std::array<voxel::corner, 8> hex_nodes = {{
+    voxel::left_bottom_back,  voxel::right_bottom_back,
+    voxel::right_top_back,    voxel::left_top_back,
+    voxel::left_bottom_front, voxel::right_bottom_front,
+    voxel::right_top_front,   voxel::left_top_front
+}};
+
+/*
+ * Hexahedral elements made from a sequence of leaves, with the corners
+ * shared by adjacent leaves merged into a single node.
+ *
+ * Nodes are identified by the Morton code of their position, and sorted by
+ * it. Each element refers to its eight nodes with indexes into this array,
+ * in the order given by hex_nodes.
+ *
+ * Note that nothing is done with hanging nodes: the corner of a small
+ * leaf lying on the face of a larger one is not a node of the latter.
+ */
+struct hexahedra
+{
+    std::vector<uint64_t> nodes;
+    std::vector<uint64_t> connectivity;
+    
+    size_t elements() const { return connectivity.size() / 8; }
+    
+    glm::u32vec3 position(size_t node) const {
+        return unmorton(nodes[node]);
+    }
+};
+
+hexahedra make_hexahedra(voxel const *leaves, size_t count,
+                         unsigned threads = concurrency());
+
+/*
+ * Sorted sets of points, used to find the points lying on a segment
+ * parallel to one of the axes. For each axis, points are sorted by the
+ * other two coordinates first, so the points on a line parallel to the
+ * axis are contiguous.
+ */
+class point_lines
+{
+public:
+    explicit point_lines(std::vector<uint64_t> const&points) {
+        for(size_t axis = 0; axis < 3; ++axis) {
+            _lines[axis].reserve(points.size());
+            for(uint64_t p : points)
+                _lines[axis].push_back(key(unmorton(p), axis));
+            parallel_sort(_lines[axis].begin(), _lines[axis].end());
+        }
+    }
+    
+    // Points strictly between a and b, in order from a to b
+    void between(glm::u32vec3 a, glm::u32vec3 b,
+                 std::vector<glm::u32vec3> &result) const
+    {
+        size_t axis = a.x != b.x ? 0 : a.y != b.y ? 1 : 2;
+        glm::u32vec3 lo = glm::min(a, b), hi = glm::max(a, b);
+        lo[axis] += 1;
+        
+        auto const&line = _lines[axis];
+        auto first = std::lower_bound(line.begin(), line.end(),
+                                      key(lo, axis));
+        auto last = std::lower_bound(first, line.end(), key(hi, axis));
+        
+        size_t size = result.size();
+        for(auto it = first; it != last; ++it) {
+            glm::u32vec3 p = a;
+            p[axis] = uint32_t(*it & coordinate_mask);
+            result.push_back(p);
+        }
+        
+        if(a[axis] > b[axis])
+            std::reverse(result.begin() + ptrdiff_t(size), result.end());
+    }
+
+private:
+    static const uint64_t coordinate_mask = (1 << 14) - 1;
+    
+    static uint64_t key(glm::u32vec3 p, size_t axis) {
+        return uint64_t(p[(axis + 1) % 3]) << 28 |
+               uint64_t(p[(axis + 2) % 3]) << 14 |
+               uint64_t(p[axis]);
+    }
+    
+    std::vector<uint64_t> _lines[3];
+};
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
@@ -0,0 +1,67 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_NUMA_H
+#define OCMESH_NUMA_H
+
+#include <vector>
+#include <cstddef>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Minimal description of the NUMA topology of the machine, read from sysfs
+ * on Linux. On other systems, or if the information is not available, the
+ * machine is described as a single node containing every CPU.
+ *
+ * Nodes are numbered densely from 0, in the order of their sysfs ids,
+ * which may have holes, and only the nodes with CPUs are counted.
+ */
+class numa_topology
+{
+public:
+    static numa_topology const&current();
+    
+    size_t nodes() const { return _cpus.size(); }
+    
+    std::vector<unsigned> const&cpus(size_t node) const { return _cpus[node]; }
+    
+    /*
+     * Node where the calling thread is currently running
+     */
+    size_t current_node() const;
+    
+    /*
+     * Pins the calling thread to a CPU chosen for the i-th worker of a pool.
+     * Consecutive workers are spread across nodes, in a round-robin fashion.
+     * Returns false if pinning is not supported or fails.
+     */
+    bool pin(size_t worker) const;
+    
+private:
+    numa_topology();
+    
+private:
+    std::vector<std::vector<unsigned>> _cpus;
+    std::vector<size_t> _node_of_cpu;
+};
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
@@ -18,18 +18,106 @@
 #ifndef OCMESH_OCTREE_H
 #define OCMESH_OCTREE_H
 
+#include "attributes.h"
 #include "csg.h"
 #include "voxel.h"
+#include "volume.h"
+#include "allocator.h"
 #include "glm.h"
 
-#include <deque>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <functional>
+#include <limits>
 
 namespace ocmesh {
 namespace details {
+
+/*
+ * Options for the multithreaded octree::build()
+ */
+struct build_options
+{
+    // Number of worker threads. Zero means one for each hardware thread.
+    unsigned threads = 0;
+    
+    // Pin each worker to a CPU, spreading the workers across NUMA nodes
+    bool pin_threads = false;
+    
+    // Back the final voxel array with huge pages, where supported
+    bool huge_pages = false;
+};
+
+/*
+ * Statistics about the last build of an octree
+ */
+struct build_stats
+{
+    unsigned threads = 1;
+    unsigned pinned_threads = 0;
+    
+    // Whether the kernel actually backed the voxel array with huge pages
+    bool huge_pages = false;
+    
+    size_t leaves = 0;
+    
+    // Number of subtrees subdivided independently by the workers
+    size_t tasks = 0;
+    
+    // Leaves first-touched, while copying them to the voxel array, by the
+    // workers running on each node. Empty unless every worker was pinned,
+    // since the node of a thread that isn't pinned can change at any time.
+    std::vector<size_t> leaves_per_node;
+    
+    // Wall-clock time of the build, in seconds
+    double seconds = 0;
+};
+
+/*
+ * Distances kept as leaf attributes by octree::build_batched(). Distances
+ * are signed, negative inside, and measured in the units of the scene from
+ * the boundary of the first object that contains the sample point, or of
+ * the nearest object if none does.
+ */
+struct distance_options
+{
+    // Distance at the center of each leaf, which the build computes
+    // anyway, as the "center_distance" attribute
+    bool centers = true;
+    
+    // Distances at the eight corners of each leaf, in Morton order, as the
+    // eight components of the "corner_distances" attribute
+    bool corners = false;
+    
+    // Store the distances in half precision instead of single precision
+    bool half = false;
+};
+
+/*
+ * Options for octree::build_sharded()
+ */
+struct shard_options
+{
+    // The top levels are expanded down to this depth, and each voxel still
+    // to be subdivided at this depth becomes a shard.
+    uint8_t depth = 2;
     
+    // Maximum number of worker processes running at the same time.
+    // Zero means one for each hardware thread.
+    unsigned processes = 0;
+    
+    // Directory where workers write their sorted runs. If empty, runs go to
+    // /dev/shm when available, so they live in shared memory, or to the
+    // temporary directory otherwise.
+    std::string directory;
+};
+    
+class slice_image; // See slice.h
+
 class octree
 {
-    using container_t = std::deque<voxel>;
+    using container_t = std::vector<voxel, octree_allocator<voxel>>;
     
 public:
     using value_type             = voxel;
@@ -43,8 +131,22 @@ public:
     using const_reverse_iterator = container_t::const_reverse_iterator;
     using difference_type        = container_t::difference_type;
     
+public:
+    /*
+     * Storage modes. A dense octree stores every leaf, including the void
+     * ones that cover the empty space. A sparse octree stores only non-void
+     * leaves, and every query treats the missing ranges as void. Every
+     * build function honors the storage mode of the octree it fills.
+     */
+    enum storage_t {
+        dense,
+        sparse
+    };
+    
 public:
     octree() = default;
+    explicit octree(storage_t storage) : _storage(storage) { }
+    
     octree(octree const&) = default;
     octree(octree     &&) = default;
     
@@ -72,11 +174,70 @@ public:
      */
     bool empty() const { return _data.empty(); }
     
+    storage_t storage() const { return _storage; }
+    
+    /*
+     * Drops the void leaves and switches the octree to sparse storage
+     */
+    void sparsify();
+    
+    /*
+     * Point location: finds the leaf containing the base cell at the given
+     * coordinates. Returns end() if there is no such leaf, which in a sparse
+     * octree means that the point is in the void.
+     *
+     * The batched version locates count points at once. Points are visited
+     * in Morton order, so that each search starts from the previous result.
+     */
+    const_iterator locate(glm::u16vec3 point) const;
+    void locate(glm::u16vec3 const *points, size_t count,
+                const_iterator *result) const;
+    
+    /*
+     * Material at the given point, taking into account the void ranges
+     * missing from sparse octrees
+     */
+    voxel::material_t material_at(glm::u16vec3 point) const;
+    
+    /*
+     * Ray casting: finds the first solid leaf hit by a ray, walking the
+     * leaves along it in order. At each step, the leaf across the face
+     * where the ray leaves the current one is located by the Morton code
+     * of the cell next to the exit point, like neighbor() does. Gaps of
+     * sparse octrees are crossed as a whole, a Morton-aligned cube at a
+     * time. Origin and direction are in voxel coordinates, and the
+     * direction doesn't need to be normalized.
+     * Rays that miss every solid leaf within the given distance return
+     * a hit with the end() iterator and the void material.
+     *
+     * The batched version casts count rays in parallel, in packets of
+     * consecutive rays, so rays that are close to each other should be
+     * kept close in the input, to share the cached parts of the octree.
+     */
+    struct ray_hit {
+        const_iterator leaf;
+        voxel::material_t material;
+        float distance; // From the origin, in voxel units
+    };
+    
+    ray_hit raycast(glm::vec3 origin, glm::vec3 direction,
+                    float max_distance =
+                        std::numeric_limits<float>::infinity()) const;
+    void raycast(glm::vec3 const *origins, glm::vec3 const *directions,
+                 size_t count, ray_hit *result,
+                 float max_distance = std::numeric_limits<float>::infinity(),
+                 unsigned threads = 0) const;
+    
     /*
      * Finds neighbor of a node corresponding to the given face.
      * A second face can be specified, to find 
      * "the neighbor at face f2 of the neighbor at face f1" of this voxel, i.e.
      * edge neighbors of this voxel.
+     *
+     * The result is the leaf that contains the cell adjacent to the given
+     * face, so it may be larger than the node. If the node is at the border
+     * of the space, or if the neighbor is missing from a sparse octree,
+     * end() is returned.
      */
     iterator       neighbor(const_iterator node, voxel::face f);
     const_iterator neighbor(const_iterator node, voxel::face f) const;
@@ -111,11 +272,203 @@ public:
      */
     void build(csg::scene const&scene, float precision);
     
+    /*
+     * Multithreaded versions of the above functions.
+     *
+     * The calling thread expands the top levels of the tree until there are
+     * a few open subtrees for each worker. Workers pick the subtrees one at a
+     * time, and subdivide them in private frontier buffers, which are
+     * allocated and first touched by the worker itself, so that on NUMA
+     * machines they live on the node where the worker runs. At the end,
+     * each worker copies its leaves to their final position in the octree.
+     *
+     * The resulting octree is the same produced by the serial version.
+     * See build_options for the available knobs, and stats() for what
+     * happened during the build.
+     */
+    void build(split_function_t split_function, build_options const&options);
+    void build(csg::scene const&scene, float precision,
+               build_options const&options);
+    
+    /*
+     * Level-synchronous build.
+     *
+     * Instead of examining one voxel at a time, the whole frontier of each
+     * level is kept in a contiguous array of Morton codes and classified in
+     * bulk by the split function, which receives a batch of voxels of the
+     * given level and has to fill the array of their materials, with the
+     * same meaning as for split_function_t. Batches are classified in
+     * parallel on the given number of threads (zero means one for each
+     * hardware thread). The voxels to split are then compacted into the next
+     * level's frontier with a prefix sum, without any per-voxel container
+     * operation.
+     *
+     * The resulting octree is the same produced by the other builds.
+     */
+    using batch_split_function_t = std::function<
+        void(voxel::level_t level, uint64_t const *morton, size_t count,
+             voxel::material_t *materials)
+    >;
+    void build_batched(batch_split_function_t split_function,
+                       unsigned threads = 0);
+    void build_batched(csg::scene const&scene, float precision,
+                       unsigned threads = 0);
+    
+    /*
+     * Same as above, but the distances computed by the build are kept as
+     * leaf attributes instead of being thrown away, as chosen by the
+     * options (see distance_options). Corner distances are not computed by
+     * the build, so they're sampled afterwards, in parallel.
+     */
+    void build_batched(csg::scene const&scene, float precision,
+                       distance_options const&distances,
+                       unsigned threads = 0);
+    
+    /*
+     * Statistics about the last build
+     */
+    build_stats const&stats() const { return _stats; }
+    
+    /*
+     * Sharded build, which uses separate processes instead of threads.
+     *
+     * The calling process acts as a coordinator: it expands the top levels
+     * of the tree by itself, then forks a worker process for each open
+     * voxel at the shard depth. Each worker subdivides its shard and writes
+     * the sorted leaves in a run file, that the coordinator maps and merges
+     * in Morton order. The result is the same of the serial build.
+     *
+     * Since workers live in separate address spaces, a crash in one of them
+     * doesn't bring down the coordinator: the function returns false if
+     * any shard fails, leaving the octree empty.
+     */
+    bool build_sharded(split_function_t split_function,
+                       shard_options const&options);
+    
+    /*
+     * Bulk construction from external data. Instead of subdividing from the
+     * root, these functions start from the finest cells and build the
+     * octree bottom-up, by merging complete groups of eight siblings of the
+     * same material into their parent. Independent subtrees are merged in
+     * parallel.
+     *
+     * The first version takes a dense labeled volume (see volume.h), which
+     * is placed with its origin at the origin of the octree, at the
+     * coarsest level that can hold it. Cells outside the volume are void.
+     *
+     * The second version takes a sorted list of disjoint labeled voxels,
+     * usually all at the same fine level. Regions not covered by any of
+     * them are filled with void voxels.
+     *
+     * The build from a volume returns false, leaving the octree empty, if
+     * the volume has labels above volume::max_label, which would overflow
+     * the materials.
+     */
+    bool build(volume const&vol);
+    void build(std::vector<voxel> const&leaves);
+    
+    /*
+     * Rule used by coarsen() to resolve a cell of the target level whose
+     * subtree contains leaves of different materials.
+     *
+     * The function receives the coarse cell (with unknown material) and the
+     * range of leaves that it covers, in Morton order. It must return the
+     * material to assign to the coarse cell, or voxel::unknown_material to
+     * keep the leaves refined as they are.
+     */
+    using coarsen_function_t = std::function<
+        voxel::material_t(voxel, const_iterator, const_iterator)
+    >;
+    
+    /*
+     * Predefined coarsening rules:
+     * - majority: the material that covers the largest volume wins.
+     * - priority: the first material of the given list that appears in the
+     *   cell wins. If none of them appears, falls back to the majority rule.
+     * - keep_refined: mixed cells are not coarsened at all.
+     */
+    static coarsen_function_t majority_rule();
+    static coarsen_function_t priority_rule(
+                                    std::vector<voxel::material_t> order);
+    static coarsen_function_t keep_refined_rule();
+    
+    /*
+     * Returns a new octree truncated at the given maximum level.
+     * Leaves deeper than the level are collapsed into their ancestor at
+     * that level, which gets their material if they all agree, or the one
+     * chosen by the rule otherwise.
+     *
+     * The result is obtained with a single linear pass over the leaves,
+     * without rebuilding anything.
+     */
+    octree coarsen(voxel::level_t level,
+                   coarsen_function_t rule = majority_rule()) const;
+    
+    /*
+     * Same as above, but produces an entire level of detail hierarchy in a
+     * single sweep over the leaves: one octree for each requested level, in
+     * the same order as the given levels.
+     */
+    std::vector<octree> lod(std::vector<voxel::level_t> const&levels,
+                            coarsen_function_t rule = majority_rule()) const;
+    
+    /*
+     * Leaf attributes: named arrays of values attached to the leaves, in
+     * their natural order (see attributes.h). Every build function clears
+     * them, sparsify() drops the values of the void leaves together with
+     * the leaves, and mesh_partitioned() exports them as cell fields.
+     * The octrees produced by coarsen() and lod() have no attributes.
+     */
+    std::vector<leaf_attribute> const&attributes() const {
+        return _attributes;
+    }
+    
+    // The attribute with the given name, or nullptr if there's none
+    leaf_attribute const*attribute(std::string const&name) const;
+    
+    // Adds an attribute, which must have a value for each leaf,
+    // replacing the one with the same name, if any
+    void set_attribute(leaf_attribute attribute);
+    
+    void clear_attributes() { _attributes.clear(); }
+    
+    /*
+     * Volume fractions of the leaves cut by the boundaries of the scene.
+     *
+     * Leaves of the finest level take the material found at their center,
+     * even when a boundary crosses them. This function estimates the part
+     * of their volume that belongs to each material, by subsampling them
+     * down to the given depth, recursing only into the subcells that a
+     * boundary may still cross. The subcells of each depth are classified
+     * in batches, in parallel, with the batched distance functions of the
+     * scene objects. The scene must be the one the octree was built from.
+     *
+     * The fractions are stored as an attribute named "volume_fraction_<m>"
+     * for each material m of the scene, void included. Leaves that aren't
+     * cut by any boundary have a fraction of one for their own material.
+     */
+    void compute_volume_fractions(csg::scene const&scene, uint8_t depth = 3,
+                                  unsigned threads = 0);
+    
+    /*
+     * Cross section of the octree on the plane orthogonal to the given
+     * axis (0 for x, 1 for y, 2 for z) through the cells with the given
+     * coordinate, rasterized with the given number of pixels per side.
+     *
+     * Only the nodes that the plane crosses are visited, each one found
+     * with a binary search in the Morton range of its parent, and only
+     * down to the size of a pixel. The top nodes are rasterized in
+     * parallel. No mesh is built. See slice.h for the result.
+     */
+    slice_image slice(uint8_t axis, uint16_t position, unsigned resolution,
+                      unsigned threads = 0) const;
+    
     /*
      * Different mesh formats supported by the mesh() function
      */
     enum mesh_t {
-        obj
+        obj,
+        msh  // Gmsh MSH 4.1 binary, with hexahedral elements
     };
     
     /*
@@ -123,16 +476,76 @@ public:
      */
     void mesh(mesh_t mesh_type, std::ostream &outs) const;
     
+    /*
+     * Partitioned VTK export, for meshes too large for a single file.
+     *
+     * The solid leaves are split in the given number of Morton ranges
+     * (by default one per thread), each written concurrently as a separate
+     * .vtu piece next to the given .pvtu index file. Nodes are numbered
+     * locally in each piece, and the ones shared with other pieces are
+     * flagged. Leaf attributes are written as cell fields besides the
+     * material. Returns false if some file can't be written.
+     */
+    bool mesh_partitioned(std::string const&path, unsigned pieces = 0) const;
+    
+    /*
+     * OpenFOAM polyMesh export. The points, faces, owner, neighbour and
+     * boundary files are written in the given directory, which is created
+     * if needed. Every solid leaf is a cell, faces are split where cells
+     * of different size meet, and boundary faces are grouped in a patch
+     * for each material. Returns false if some file can't be written.
+     */
+    bool mesh_openfoam(std::string const&directory) const;
+    
 private:
+    void subdivide(split_function_t const&split_function, size_t from);
+    
+    // Drops void leaves in the given range if the storage is sparse,
+    // returning the new end of the range
+    template<typename It>
+    It drop_void(It first, It last) const;
+    
+    void expand(split_function_t const&split_function, uint8_t depth,
+                std::vector<voxel> &leaves, std::vector<voxel> &open) const;
+    
+    // Level-synchronous build, optionally collecting the center distance
+    // returned by the split function for each leaf, in leaf order
+    using batch_sample_function_t = std::function<
+        void(voxel::level_t level, uint64_t const *morton, size_t count,
+             voxel::material_t *materials, float *distances)
+    >;
+    void build_levels(batch_sample_function_t const&split_function,
+                      unsigned threads, std::vector<float> *distances);
+    
+private:
+    friend class coarsener;
+    
+    storage_t    _storage = dense;
     container_t  _data;
     glm::f32mat4 _transform; // default-constructed as the identity matrix
+    build_stats  _stats;
+    
+    std::vector<leaf_attribute> _attributes;
 };
 
+template<typename It>
+It octree::drop_void(It first, It last) const
+{
+    if(_storage != sparse)
+        return last;
     
+    return std::remove_if(first, last, [](voxel v) {
+        return v.material() == voxel::void_material;
+    });
+}
 
 } // namespace details
 
 using details::octree;
+using details::build_options;
+using details::build_stats;
+using details::distance_options;
+using details::shard_options;
     
 } // namespace ocmesh
 
@@ -0,0 +1,119 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_PARALLEL_H
+#define OCMESH_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Number of threads to use by default in parallel algorithms
+     */
+    inline unsigned concurrency() {
+        unsigned n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+    
+    /*
+     * Calls f(i) for every i in [0, n), distributing the indexes over the
+     * given number of threads. Indexes are handed out dynamically, one at a
+     * time, so the caller decides the granularity by choosing what a
+     * single index means. The calling thread takes part in the work.
+     */
+    template<typename F>
+    void parallel_for(size_t n, F const&f, unsigned threads = concurrency())
+    {
+        threads = unsigned(std::min<size_t>(threads, n));
+        
+        if(threads <= 1) {
+            for(size_t i = 0; i < n; ++i)
+                f(i);
+            return;
+        }
+        
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for(size_t i = next++; i < n; i = next++)
+                f(i);
+        };
+        
+        std::vector<std::thread> pool;
+        for(unsigned t = 1; t < threads; ++t)
+            pool.emplace_back(worker);
+        
+        worker();
+        
+        for(std::thread &t : pool)
+            t.join();
+    }
+    
+    /*
+     * Sorts the range with one chunk per thread, followed by rounds of
+     * pairwise merges of the sorted chunks, also done in parallel.
+     */
+    template<typename It, typename Compare>
+    void parallel_sort(It first, It last, Compare const&less,
+                       unsigned threads = concurrency())
+    {
+        size_t n = size_t(last - first);
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(threads, n / 4096));
+        
+        if(chunks <= 1) {
+            std::sort(first, last, less);
+            return;
+        }
+        
+        size_t width = (n + chunks - 1) / chunks;
+        auto bound = [&](size_t i) {
+            return first + std::min(n, i * width);
+        };
+        
+        parallel_for(chunks, [&](size_t i) {
+            std::sort(bound(i), bound(i + 1), less);
+        }, threads);
+        
+        for(size_t step = 1; step < chunks; step *= 2) {
+            size_t pairs = (chunks + 2 * step - 1) / (2 * step);
+            parallel_for(pairs, [&](size_t p) {
+                size_t i = p * 2 * step;
+                std::inplace_merge(bound(i), bound(i + step),
+                                   bound(i + 2 * step), less);
+            }, threads);
+        }
+    }
+    
+    template<typename It>
+    void parallel_sort(It first, It last, unsigned threads = concurrency())
+    {
+        using value_type = typename std::iterator_traits<It>::value_type;
+        
+        parallel_sort(first, last, std::less<value_type>(), threads);
+    }
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
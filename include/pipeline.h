@@ -0,0 +1,92 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_PIPELINE_H
+#define OCMESH_PIPELINE_H
+
+#include "octree.h"
+
+#include <std14/memory>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Interface of the exporters that can write a mesh while its leaves are
+ * still being produced. Leaves are given in chunks, in Morton order, and
+ * finish() is called after the last one.
+ */
+class mesh_writer
+{
+public:
+    virtual ~mesh_writer();
+    
+    virtual void write(voxel const *leaves, size_t count) = 0;
+    virtual void finish() = 0;
+    
+    /*
+     * Returns the streaming writer for the given format
+     */
+    static std::unique_ptr<mesh_writer> make(octree::mesh_t type,
+                                             std::ostream &out);
+};
+
+std::unique_ptr<mesh_writer> make_obj_writer(std::ostream &out);
+std::unique_ptr<mesh_writer> make_msh_writer(std::ostream &out);
+
+/*
+ * Depth-first build. The space is subdivided exactly like octree::build()
+ * does, but the leaves are never stored: since the tree is visited in
+ * pre-order, leaves become final in Morton order, and they are handed to
+ * the given function in chunks of the given size as soon as they're ready.
+ */
+void build_depth_first(octree::split_function_t const&split_function,
+                       size_t chunk,
+                       std::function<void(std::vector<voxel>)> const&emit);
+
+/*
+ * Streaming pipeline from the build to the export.
+ *
+ * The depth-first build runs on a separate thread, and sends the chunks of
+ * leaves through a bounded queue to the exporter, which runs on the calling
+ * thread. Writing starts as soon as the first chunk is ready, and the
+ * memory used is bounded by the size of the queue, regardless of the size
+ * of the octree.
+ *
+ * Exceptions thrown by the split function are rethrown on the calling
+ * thread, after the chunks already built are written, but before
+ * finishing the mesh. If the exporter throws, the build is stopped and
+ * the exception propagates.
+ */
+void stream_mesh(octree::split_function_t split_function,
+                 octree::mesh_t type, std::ostream &out);
+
+void stream_mesh(csg::scene const&scene, float precision,
+                 octree::mesh_t type, std::ostream &out);
+    
+} // namespace details
+
+using details::mesh_writer;
+using details::build_depth_first;
+using details::stream_mesh;
+
+} // namespace ocmesh
+
+#endif
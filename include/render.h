@@ -0,0 +1,90 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_RENDER_H
+#define OCMESH_RENDER_H
+
+#include "csg.h"
+#include "voxel.h"
+#include "glm.h"
+
+#include <ostream>
+
+namespace ocmesh {
+namespace details {
+
+/*
+ * Color of each material in the images produced by the library. Void is
+ * black, and the other materials cycle through a palette of well
+ * separated colors.
+ */
+glm::u8vec3 material_color(voxel::material_t material);
+
+/*
+ * Options for render()
+ */
+struct render_options
+{
+    unsigned width = 640;
+    unsigned height = 480;
+    
+    // The camera looks at the center of the scene from this direction,
+    // far enough to see the whole bounding box
+    glm::vec3 view = glm::vec3(2.0f, 1.5f, 1.0f);
+    
+    // Vertical field of view, in degrees
+    float fov = 40;
+    
+    // Side of the square tiles of pixels traced together
+    unsigned tile = 16;
+    
+    // Maximum number of steps along each ray
+    unsigned max_steps = 256;
+    
+    // Fraction of the distance taken at each step. Distances of the CSG
+    // operations are bounds, and the ones of transformed objects aren't
+    // rescaled, so a full step could overshoot a surface.
+    float step = 0.8f;
+    
+    // Number of threads. Zero means one for each hardware thread.
+    unsigned threads = 0;
+};
+
+/*
+ * Preview of a scene as a binary PPM image, made by sphere tracing its
+ * distance functions, without building any octree.
+ *
+ * The image is split in tiles, traced in parallel. The rays of a tile are
+ * marched together, so that each step evaluates every object once, with
+ * its batched distance function, on all the rays still marching. Each ray
+ * advances by a fraction of the distance from the scene, and hits it when
+ * the distance gets below the footprint of a pixel. Hit points get the
+ * color of their material, shaded by the angle between the normal and the
+ * ray.
+ */
+void render(csg::scene const&scene, std::ostream &out,
+            render_options const&options = render_options());
+    
+} // namespace details
+
+using details::material_color;
+using details::render_options;
+using details::render;
+
+} // namespace ocmesh
+
+#endif
@@ -0,0 +1,297 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_SCENE_BUILDER_H
+#define OCMESH_SCENE_BUILDER_H
+
+#include "csg.h"
+#include "voxel.h"
+#include "glm.h"
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <limits>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Function object for the subdivision of the octree from the CSG scene.
+     */
+    class scene_builder
+    {
+    public:
+        scene_builder(csg::scene const&scene, float precision)
+            : _scene(scene), _bounding_box(_scene.bounding_box()),
+              _precision(precision) { }
+        
+        
+        voxel::material_t operator()(voxel v) const {
+            for(auto *obj : _scene) {
+                intersection_result r = intersection(obj, v);
+                if(r == inside)
+                    return obj->material();
+                if(r == at_intersection)
+                    return voxel::unknown_material;
+            }
+            
+            return voxel::void_material;
+        }
+        
+        /*
+         * Batched version, for the level-synchronous build. Each object of
+         * the scene is tested against all the voxels of the batch that are
+         * still undecided, with a single batched distance evaluation.
+         *
+         * If an array for the center distances is given, it's filled with
+         * the distance computed for the object that decided each voxel,
+         * or with the smallest one for voxels outside of every object,
+         * which is the same value that field() returns at the centers.
+         */
+        void operator()(voxel::level_t level, uint64_t const *morton,
+                        size_t count, voxel::material_t *materials,
+                        float *center_distances = nullptr) const
+        {
+            float side = this->side(level);
+            
+            std::vector<size_t> pending(count);
+            std::vector<glm::vec3> centers(count);
+            std::vector<float> distances(count);
+            
+            for(size_t i = 0; i < count; ++i) {
+                pending[i] = i;
+                centers[i] = center(voxel(morton[i], level, 0));
+                if(center_distances)
+                    center_distances[i] =
+                        std::numeric_limits<float>::infinity();
+            }
+            
+            for(auto *obj : _scene) {
+                size_t n = pending.size();
+                if(n == 0)
+                    break;
+                
+                obj->distances(centers.data(), distances.data(), n);
+                
+                size_t still = 0;
+                for(size_t k = 0; k < n; ++k) {
+                    intersection_result r = classify(distances[k], side);
+                    if(center_distances && (r != outside ||
+                       distances[k] < center_distances[pending[k]]))
+                        center_distances[pending[k]] = distances[k];
+                    
+                    if(r == inside)
+                        materials[pending[k]] = obj->material();
+                    else if(r == at_intersection)
+                        materials[pending[k]] = voxel::unknown_material;
+                    else {
+                        pending[still] = pending[k];
+                        centers[still] = centers[k];
+                        ++still;
+                    }
+                }
+                pending.resize(still);
+            }
+            
+            for(size_t i : pending)
+                materials[i] = voxel::void_material;
+        }
+        
+        /*
+         * Signed distance field of the scene, at points given in voxel
+         * coordinates: the distance from the first object that contains
+         * the point, or from the nearest object if none does. The result
+         * is in the units of the scene. If an array for the materials is
+         * given, it's filled with the material of each point.
+         */
+        void field(glm::vec3 const *points, size_t count, float *result,
+                   voxel::material_t *materials = nullptr) const
+        {
+            std::vector<size_t> pending(count);
+            std::vector<glm::vec3> positions(count);
+            std::vector<float> distances(count);
+            
+            for(size_t i = 0; i < count; ++i) {
+                pending[i] = i;
+                positions[i] = points[i] * scale() + _bounding_box.min();
+                result[i] = std::numeric_limits<float>::infinity();
+                if(materials)
+                    materials[i] = voxel::void_material;
+            }
+            
+            for(auto *obj : _scene) {
+                size_t n = pending.size();
+                if(n == 0)
+                    break;
+                
+                obj->distances(positions.data(), distances.data(), n);
+                
+                size_t still = 0;
+                for(size_t k = 0; k < n; ++k) {
+                    size_t i = pending[k];
+                    if(distances[k] <= 0 || distances[k] < result[i])
+                        result[i] = distances[k];
+                    
+                    if(distances[k] <= 0 && materials)
+                        materials[i] = obj->material();
+                    else if(distances[k] > 0) {
+                        pending[still] = i;
+                        positions[still] = positions[k];
+                        ++still;
+                    }
+                }
+                pending.resize(still);
+            }
+        }
+        
+        /*
+         * Distance from the nearest boundary of any object of the scene, at
+         * points given in voxel coordinates, in the units of the scene.
+         * Unlike field(), every object is evaluated at every point.
+         */
+        void boundary_distances(glm::vec3 const *points, size_t count,
+                                float *result) const
+        {
+            std::vector<glm::vec3> positions(count);
+            std::vector<float> distances(count);
+            
+            for(size_t i = 0; i < count; ++i) {
+                positions[i] = points[i] * scale() + _bounding_box.min();
+                result[i] = std::numeric_limits<float>::infinity();
+            }
+            
+            for(auto *obj : _scene) {
+                obj->distances(positions.data(), distances.data(), count);
+                for(size_t i = 0; i < count; ++i)
+                    result[i] = std::min(result[i], std::abs(distances[i]));
+            }
+        }
+        
+        /*
+         * Classification of sample cubes, given by their centers and sides
+         * in voxel coordinates, used to subsample the leaves cut by the
+         * boundaries. Each cube gets the material of the first object that
+         * contains its center, as the leaves of the finest level do, and is
+         * flagged as cut if the boundary of that object, or of any object
+         * examined before it, may cross the cube.
+         */
+        void sample(glm::vec3 const *centers, float const *sides,
+                    size_t count, voxel::material_t *materials,
+                    uint8_t *cut) const
+        {
+            std::vector<size_t> pending(count);
+            std::vector<glm::vec3> points(count);
+            std::vector<float> distances(count);
+            
+            for(size_t i = 0; i < count; ++i) {
+                pending[i] = i;
+                points[i] = centers[i] * scale() + _bounding_box.min();
+                cut[i] = false;
+            }
+            
+            for(auto *obj : _scene) {
+                size_t n = pending.size();
+                if(n == 0)
+                    break;
+                
+                obj->distances(points.data(), distances.data(), n);
+                
+                size_t still = 0;
+                for(size_t k = 0; k < n; ++k) {
+                    size_t i = pending[k];
+                    float diagonal = std::sqrt(3) * sides[i] * scale();
+                    
+                    if(std::abs(distances[k]) < diagonal / 2)
+                        cut[i] = true;
+                    
+                    if(distances[k] <= 0)
+                        materials[i] = obj->material();
+                    else {
+                        pending[still] = i;
+                        points[still] = points[k];
+                        ++still;
+                    }
+                }
+                pending.resize(still);
+            }
+            
+            for(size_t i : pending)
+                materials[i] = voxel::void_material;
+        }
+        
+    private:
+        enum intersection_result {
+            inside,
+            outside,
+            at_intersection
+        };
+        
+        /*
+         * The core function of the subdivision procedure is here. It decides
+         * if a voxel intersects a given CSG object or not.
+         */
+        intersection_result intersection(csg::object *obj, voxel v) const
+        {
+            float d = obj->distance(center(v));
+            
+            return classify(d, side(v.level()));
+        }
+        
+        intersection_result classify(float d, float side) const
+        {
+            float diagonal = std::sqrt(3) * side;
+            
+            if(std::abs(d) < diagonal / 2 &&
+               side >= _bounding_box.side() * _precision)
+            {
+                return at_intersection;
+            }
+            
+            return d > 0 ? outside : inside;
+        }
+        
+        // Scale from voxel coordinates to the scene bounding box
+        float scale() const {
+            return _bounding_box.side() / voxel::max_coordinate;
+        }
+        
+        float side(voxel::level_t level) const {
+            float side = uint16_t(1 << (voxel::max_level - level));
+            return side * scale();
+        }
+        
+        glm::vec3 center(voxel v) const
+        {
+            glm::vec3 coordinates = glm::vec3(v.coordinates());
+            float side = this->side(v.level());
+            
+            coordinates = coordinates * scale() + _bounding_box.min();
+            
+            return coordinates + glm::vec3{ side / 2, side / 2, side / 2 };
+        }
+        
+    private:
+        csg::scene const&_scene;
+        csg::bounding_box _bounding_box;
+        float _precision;
+    };
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif
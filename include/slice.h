@@ -0,0 +1,77 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_SLICE_H
+#define OCMESH_SLICE_H
+
+#include "octree.h"
+
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+
+/*
+ * Materials of an octree on a plane orthogonal to one of the axes, made by
+ * octree::slice(), rasterized on a square image that covers the whole
+ * domain.
+ *
+ * The horizontal axis of the image is the one following the normal of
+ * the plane, and the vertical one is the next, pointing up, so an x slice
+ * shows y rightwards and z upwards. Each pixel gets the material of the
+ * cell at its center. Labels are stored by rows, from the top one.
+ */
+class slice_image
+{
+public:
+    enum format_t {
+        pgm, // Grayscale image of the labels, 8 or 16 bits as needed
+        ppm, // Color image, with the colors of material_color()
+        raw  // Labels as native 32 bits integers, without any header
+    };
+    
+    slice_image() = default;
+    slice_image(unsigned resolution)
+        : _resolution(resolution),
+          _labels(size_t(resolution) * resolution,
+                  voxel::material_t(voxel::void_material)) { }
+    
+    unsigned width() const { return _resolution; }
+    unsigned height() const { return _resolution; }
+    
+    voxel::material_t at(unsigned x, unsigned y) const {
+        return _labels[size_t(y) * _resolution + x];
+    }
+    
+    std::vector<voxel::material_t> const&labels() const { return _labels; }
+    std::vector<voxel::material_t>       &labels()       { return _labels; }
+    
+    void write(std::ostream &out, format_t format) const;
+
+private:
+    unsigned _resolution = 0;
+    std::vector<voxel::material_t> _labels;
+};
+    
+} // namespace details
+
+using details::slice_image;
+
+} // namespace ocmesh
+
+#endif
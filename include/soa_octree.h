@@ -0,0 +1,156 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_SOA_OCTREE_H
+#define OCMESH_SOA_OCTREE_H
+
+#include "octree.h"
+
+#include <vector>
+#include <cstring>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * Structure-of-arrays layout of an octree, for search-heavy workloads.
+ *
+ * The voxel class packs location, level and material in a single word, so
+ * binary searches drag the materials through the cache, and material scans
+ * drag the locations. Here instead the leaves are split in two arrays:
+ *
+ * - the keys, i.e. the Morton code and the level of each leaf, which keep
+ *   the same order of the voxel codes;
+ * - the materials, stored as indexes into a palette of the materials
+ *   actually used, with 1, 2 or 4 bytes each depending on their number.
+ *
+ * The layout is read-only: it's built from an existing octree.
+ */
+class soa_octree
+{
+public:
+    static constexpr size_t npos = size_t(-1);
+    
+    soa_octree() = default;
+    explicit soa_octree(octree const&oc);
+    
+    size_t size() const { return _keys.size(); }
+    bool empty() const { return _keys.empty(); }
+    
+    octree::storage_t storage() const { return _storage; }
+    
+    /*
+     * Raw access to the two arrays
+     */
+    std::vector<uint64_t> const&keys() const { return _keys; }
+    
+    std::vector<voxel::material_t> const&palette() const { return _palette; }
+    
+    size_t material_bytes() const { return _width; }
+    
+    /*
+     * Access to single leaves
+     */
+    uint64_t morton(size_t i) const {
+        return _keys[i] >> voxel::level_bits;
+    }
+    
+    voxel::level_t level(size_t i) const {
+        return voxel::level_t(_keys[i] & lowmask(voxel::level_bits));
+    }
+    
+    voxel::material_t material(size_t i) const {
+        return _palette[index(i)];
+    }
+    
+    voxel operator[](size_t i) const {
+        return voxel(morton(i), level(i), material(i));
+    }
+    
+    /*
+     * Queries, with the same semantics of the corresponding functions of
+     * the octree class, returning indexes instead of iterators, and npos
+     * instead of end().
+     */
+    size_t locate(glm::u16vec3 point) const;
+    
+    voxel::material_t material_at(glm::u16vec3 point) const;
+    
+    size_t neighbor(size_t i, voxel::face f) const;
+    
+    /*
+     * Material scans, which only touch the material array
+     */
+    size_t count(voxel::material_t material) const;
+    
+    // Number of leaves of each material of the palette, in palette order
+    std::vector<size_t> histogram() const;
+    
+private:
+    static uint64_t key(voxel v) {
+        return v.morton() << voxel::level_bits | v.level();
+    }
+    
+    uint32_t index(size_t i) const
+    {
+        switch(_width) {
+            case 1:
+                return _materials[i];
+            case 2:
+                return load<uint16_t>(i);
+            default:
+                return load<uint32_t>(i);
+        }
+    }
+    
+    template<typename T>
+    T load(size_t i) const {
+        T value;
+        std::memcpy(&value, _materials.data() + i * sizeof(T), sizeof(T));
+        return value;
+    }
+    
+    // Stores converted to the element type first, so that the bytes are
+    // the ones of that type on every platform, whatever the endianness
+    template<typename T>
+    void store(size_t i, T value) {
+        std::memcpy(_materials.data() + i * sizeof(T), &value, sizeof(T));
+    }
+    
+    template<typename T>
+    std::vector<size_t> histogram() const;
+    
+    // Number of leaves with the given palette index
+    template<typename T>
+    size_t occurrences(T index) const;
+    
+private:
+    octree::storage_t _storage = octree::dense;
+    
+    std::vector<uint64_t> _keys;
+    std::vector<uint8_t> _materials;
+    std::vector<voxel::material_t> _palette;
+    size_t _width = 1;
+};
+
+} // namespace details
+
+using details::soa_octree;
+
+} // namespace ocmesh
+
+#endif
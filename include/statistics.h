@@ -0,0 +1,101 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_STATISTICS_H
+#define OCMESH_STATISTICS_H
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <array>
+#include <ostream>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+
+/*
+ * Geometric statistics of the materials of an octree, for validating a
+ * mesh against the model it comes from.
+ *
+ * For each material: the number of leaves, the volume, the centroid, and
+ * the inertia tensor about the centroid, for unit density. For each pair
+ * of different materials that touch, void included: the area of the
+ * interface between them. Faces on the border of the domain don't count.
+ *
+ * Everything is computed with a single parallel pass over the sorted
+ * leaves, where each task reduces a range of leaves into private sums,
+ * merged at the end. The interfaces of each leaf are found by visiting
+ * the leaves across its faces.
+ *
+ * Measures are in voxel units, or in the units of the scene if one is
+ * given, with the same mapping used to build the octree from it. In a
+ * sparse octree, the void is what's left of the domain by the other
+ * materials, so it has a volume and moments but no leaves.
+ */
+class material_statistics
+{
+public:
+    struct material {
+        voxel::material_t id;
+        size_t leaves;
+        double volume;
+        std::array<double, 3> centroid;
+        std::array<double, 9> inertia; // Row-major
+    };
+    
+    struct interface {
+        voxel::material_t first; // first < second
+        voxel::material_t second;
+        double area;
+    };
+    
+    material_statistics() = default;
+    
+    explicit material_statistics(octree const&oc,
+                                 unsigned threads = concurrency());
+    material_statistics(octree const&oc, csg::scene const&scene,
+                        unsigned threads = concurrency());
+    
+    // Sorted by material
+    std::vector<material> const&materials() const { return _materials; }
+    
+    // Sorted by the pair of materials
+    std::vector<interface> const&interfaces() const { return _interfaces; }
+    
+    /*
+     * Writes the statistics as a JSON object, with a "materials" and an
+     * "interfaces" array of objects with the fields above
+     */
+    void write_json(std::ostream &out) const;
+    
+private:
+    void compute(octree const&oc, glm::dvec3 origin, double unit,
+                 unsigned threads);
+    
+private:
+    std::vector<material> _materials;
+    std::vector<interface> _interfaces;
+};
+    
+} // namespace details
+
+using details::material_statistics;
+
+} // namespace ocmesh
+
+#endif
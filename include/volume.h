@@ -0,0 +1,124 @@
+// -*- C++ -*-
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCMESH_VOLUME_H
+#define OCMESH_VOLUME_H
+
+#include "voxel.h"
+#include "glm.h"
+
+#include <istream>
+#include <vector>
+#include <cstring>
+
+namespace ocmesh {
+namespace details {
+    
+/*
+ * A dense labeled volume, like a segmented CT scan.
+ *
+ * Labels are unsigned integers of 1, 2 or 4 bytes, stored in native byte
+ * order with the x coordinate varying fastest, then y, then z. This is the
+ * usual layout of raw binary volume files.
+ *
+ * Label 0 is the background, which becomes voxel::void_material in the
+ * octree, while label k becomes material k + 1, so that labels never clash
+ * with voxel::unknown_material. Labels of 4 bytes can then exceed the
+ * largest material, so labels above max_label can't be converted.
+ */
+class volume
+{
+public:
+    volume(glm::u32vec3 dims, unsigned label_bytes)
+        : _dims(dims), _label_bytes(label_bytes),
+          _data(size_t(dims.x) * dims.y * dims.z * label_bytes)
+    {
+        assert((label_bytes == 1 || label_bytes == 2 || label_bytes == 4) &&
+               "Unsupported label size");
+        assert(dims.x <= voxel::max_coordinate + 1 &&
+               dims.y <= voxel::max_coordinate + 1 &&
+               dims.z <= voxel::max_coordinate + 1 &&
+               "Volume too large to be represented in an octree");
+    }
+    
+    glm::u32vec3 dims() const { return _dims; }
+    
+    unsigned label_bytes() const { return _label_bytes; }
+    
+    /*
+     * Raw access to the labels, e.g. to fill the volume in place
+     */
+    uint8_t       *data()       { return _data.data(); }
+    uint8_t const *data() const { return _data.data(); }
+    
+    size_t size() const { return _data.size(); }
+    
+    /*
+     * Reads the whole volume from a raw binary stream.
+     * Returns false if the stream ends before the volume is filled.
+     */
+    bool read(std::istream &in) {
+        in.read(reinterpret_cast<char *>(_data.data()),
+                std::streamsize(_data.size()));
+        return size_t(in.gcount()) == _data.size();
+    }
+    
+    /*
+     * Label at the given coordinates
+     */
+    uint32_t label(glm::u32vec3 c) const {
+        size_t i = (size_t(c.z) * _dims.y + c.y) * _dims.x + c.x;
+        
+        switch(_label_bytes) {
+            case 1:
+                return _data[i];
+            case 2:
+                return load<uint16_t>(i);
+            default:
+                return load<uint32_t>(i);
+        }
+    }
+    
+    static constexpr uint32_t max_label =
+        uint32_t(voxel::max_material - voxel::void_material);
+    
+    static voxel::material_t material(uint32_t label) {
+        assert(label <= max_label && "Label out of the range of materials");
+        return label + voxel::void_material;
+    }
+    
+private:
+    template<typename T>
+    T load(size_t i) const {
+        T value;
+        std::memcpy(&value, _data.data() + i * sizeof(T), sizeof(T));
+        return value;
+    }
+    
+private:
+    glm::u32vec3 _dims;
+    unsigned _label_bytes;
+    std::vector<uint8_t> _data;
+};
+
+} // namespace details
+
+using details::volume;
+
+} // namespace ocmesh
+
+#endif
@@ -20,6 +20,7 @@
 
 #include <array>
 #include <cmath>
+#include <limits>
 #include <ostream>
 
 #include "utils/meta.h"
@@ -287,9 +288,9 @@ std::array<Vec, 8> voxel::corners() const
     };
 }
     
-// Check if we can add x and y without overflow
+// Check if we can add x and y without going out of the coordinate space
 constexpr bool add_is_safe(uint16_t x, uint16_t y) {
-    return x <= std::numeric_limits<uint16_t>::max() - y;
+    return x <= voxel::max_coordinate - y;
 }
 
 /*
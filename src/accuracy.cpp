@@ -0,0 +1,164 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "accuracy.h"
+#include "parallel.h"
+#include "scene_builder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+
+namespace ocmesh {
+namespace details {
+    
+    // Points located and classified together by each parallel task
+    static const size_t batch_size = 1 << 14;
+    
+    struct tally {
+        accuracy_report::counts total;
+        accuracy_report::counts boundary;
+        std::map<voxel::material_t, accuracy_report::material> materials;
+    };
+    
+    static void count(accuracy_report::counts &c, bool wrong) {
+        ++c.samples;
+        c.misclassified += wrong;
+    }
+    
+    static void merge(accuracy_report::counts &c,
+                      accuracy_report::counts const&other)
+    {
+        c.samples += other.samples;
+        c.misclassified += other.misclassified;
+    }
+    
+    accuracy_report::accuracy_report(octree const&oc, csg::scene const&scene,
+                                     accuracy_options const&options)
+    {
+        unsigned threads = options.threads ? options.threads : concurrency();
+        
+        // The precision only matters to the build, not to the sampling
+        scene_builder builder(scene, 0);
+        float unit = scene.bounding_box().side() / voxel::max_coordinate;
+        
+        // Leaves of the finest level are the only ones crossed by the
+        // boundaries, so it's only within their diagonal that errors occur
+        uint16_t finest = uint16_t(voxel::max_coordinate + 1);
+        for(voxel v : oc)
+            finest = std::min(finest, v.size());
+        float band = std::sqrt(3.0f) * finest * unit;
+        
+        size_t tasks = (options.samples + batch_size - 1) / batch_size;
+        std::vector<tally> tallies(tasks);
+        
+        parallel_for(tasks, [&](size_t t) {
+            size_t n = std::min(batch_size, options.samples - t * batch_size);
+            
+            std::mt19937_64 random(options.seed + t);
+            std::uniform_int_distribution<uint16_t>
+                coordinate(0, voxel::max_coordinate);
+            
+            std::vector<glm::u16vec3> points(n);
+            std::vector<glm::vec3> centers(n);
+            for(size_t i = 0; i < n; ++i) {
+                points[i] = glm::u16vec3(coordinate(random),
+                                         coordinate(random),
+                                         coordinate(random));
+                centers[i] = glm::vec3(points[i]) +
+                             glm::vec3(0.5f, 0.5f, 0.5f);
+            }
+            
+            std::vector<octree::const_iterator> leaves(n);
+            oc.locate(points.data(), n, leaves.data());
+            
+            std::vector<float> distances(n);
+            std::vector<voxel::material_t> expected(n);
+            builder.field(centers.data(), n, distances.data(),
+                          expected.data());
+            
+            // A point just outside an object that comes before the one
+            // containing it is as near to a boundary as one just inside
+            std::vector<float> boundaries(n);
+            builder.boundary_distances(centers.data(), n, boundaries.data());
+            
+            tally &result = tallies[t];
+            for(size_t i = 0; i < n; ++i) {
+                voxel::material_t m = leaves[i] != oc.end() ?
+                    leaves[i]->material() : voxel::void_material;
+                
+                bool wrong = m != expected[i];
+                bool near = boundaries[i] < band;
+                
+                material &entry = result.materials[expected[i]];
+                entry.id = expected[i];
+                
+                count(result.total, wrong);
+                count(entry.all, wrong);
+                if(near) {
+                    count(result.boundary, wrong);
+                    count(entry.boundary, wrong);
+                }
+            }
+        }, threads);
+        
+        std::map<voxel::material_t, material> materials;
+        for(tally const&t : tallies) {
+            merge(_total, t.total);
+            merge(_boundary, t.boundary);
+            
+            for(auto const&m : t.materials) {
+                material &entry = materials[m.first];
+                entry.id = m.first;
+                merge(entry.all, m.second.all);
+                merge(entry.boundary, m.second.boundary);
+            }
+        }
+        
+        for(auto const&m : materials)
+            _materials.push_back(m.second);
+    }
+    
+    static void write_counts(std::ostream &out, char const *name,
+                             accuracy_report::counts const&c)
+    {
+        out << "\"" << name << "\": { \"samples\": " << c.samples
+            << ", \"misclassified\": " << c.misclassified
+            << ", \"rate\": " << c.rate() << " }";
+    }
+    
+    void accuracy_report::write_json(std::ostream &out) const
+    {
+        out << "{\n  ";
+        write_counts(out, "total", _total);
+        out << ",\n  ";
+        write_counts(out, "boundary", _boundary);
+        
+        out << ",\n  \"materials\": [";
+        for(size_t i = 0; i < _materials.size(); ++i) {
+            out << (i ? ",\n" : "\n")
+                << "    { \"material\": " << _materials[i].id << ",\n      ";
+            write_counts(out, "total", _materials[i].all);
+            out << ",\n      ";
+            write_counts(out, "boundary", _materials[i].boundary);
+            out << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "amr.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Patches and materials of a single level, in the same layout of the
+     * final arrays, with positions relative to the level
+     */
+    struct level_patches {
+        std::vector<amr_patches::patch> patches;
+        std::vector<voxel::material_t> materials;
+    };
+    
+    static void group(std::vector<voxel> const&leaves, voxel::level_t level,
+                      uint8_t max_log_size, level_patches &result)
+    {
+        uint8_t height = uint8_t(voxel::max_level - level);
+        uint64_t unit = uint64_t(1) << (3 * height);
+        
+        // Bricks can't be larger than the whole domain
+        max_log_size = std::min(max_log_size, uint8_t(level));
+        
+        for(size_t i = 0; i < leaves.size(); ) {
+            uint64_t m = leaves[i].morton();
+            
+            uint8_t k = max_log_size;
+            for(; k > 0; --k) {
+                uint64_t cells = uint64_t(1) << (3 * k);
+                if(m % (cells * unit) != 0 || i + cells > leaves.size())
+                    continue;
+                if(leaves[i + cells - 1].morton() == m + (cells - 1) * unit)
+                    break;
+            }
+            
+            uint32_t side = uint32_t(1) << k;
+            uint64_t cells = uint64_t(1) << (3 * k);
+            
+            glm::u32vec3 origin(leaves[i].coordinates());
+            origin = glm::u32vec3(origin.x >> height, origin.y >> height,
+                                  origin.z >> height);
+            
+            result.patches.push_back({ level, origin,
+                                       glm::u32vec3(side, side, side),
+                                       result.materials.size() });
+            
+            size_t first = result.materials.size();
+            result.materials.resize(first + cells);
+            for(uint64_t j = 0; j < cells; ++j) {
+                glm::u32vec3 c = unmorton(j);
+                result.materials[first + c.x + side * (c.y + side * c.z)] =
+                    leaves[i + j].material();
+            }
+            
+            i += cells;
+        }
+    }
+    
+    amr_patches::amr_patches(octree const&oc, uint8_t max_log_size)
+    {
+        std::vector<std::vector<voxel>> levels(voxel::max_level + 1);
+        for(voxel v : oc)
+            levels[v.level()].push_back(v);
+        
+        std::vector<level_patches> grouped(levels.size());
+        parallel_for(levels.size(), [&](size_t l) {
+            group(levels[l], voxel::level_t(l), max_log_size, grouped[l]);
+            std::vector<voxel>().swap(levels[l]);
+        });
+        
+        for(level_patches &g : grouped) {
+            size_t offset = _materials.size();
+            for(patch p : g.patches) {
+                p.first += offset;
+                _patches.push_back(p);
+            }
+            _materials.insert(_materials.end(),
+                              g.materials.begin(), g.materials.end());
+        }
+    }
+    
+    template<typename T>
+    static void put(std::ostream &out, T value) {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+    
+    bool amr_patches::write(std::ostream &out) const
+    {
+        put(out, uint64_t(_patches.size()));
+        put(out, uint64_t(_materials.size()));
+        
+        for(patch const&p : _patches) {
+            put(out, uint32_t(p.level));
+            for(int c = 0; c < 3; ++c)
+                put(out, uint32_t(p.origin[c]));
+            for(int c = 0; c < 3; ++c)
+                put(out, uint32_t(p.dims[c]));
+            put(out, uint64_t(p.first));
+        }
+        
+        out.write(reinterpret_cast<char const *>(_materials.data()),
+                  std::streamsize(_materials.size() *
+                                  sizeof(voxel::material_t)));
+        
+        return bool(out);
+    }
+    
+} // namespace details
+} // namespace ocmesh
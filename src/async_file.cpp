@@ -0,0 +1,461 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_file.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef OCMESH_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace ocmesh {
+namespace details {
+    
+    constexpr size_t async_filebuf::default_buffer_size;
+    
+    async_filebuf::backend::~backend() = default;
+    
+    /*
+     * Writes the whole buffer, also after short writes
+     */
+    static bool pwrite_all(int fd, char const *data, size_t size,
+                           uint64_t offset)
+    {
+        while(size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, off_t(offset));
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            
+            data += written;
+            size -= size_t(written);
+            offset += uint64_t(written);
+        }
+        
+        return true;
+    }
+    
+    /*
+     * Fallback backend: a single thread doing blocking pwrite() calls
+     */
+    class writer_thread : public async_filebuf::backend
+    {
+        struct job {
+            char const *data = nullptr;
+            size_t size = 0;
+            uint64_t offset = 0;
+            bool pending = false;
+            bool ok = true;
+        };
+        
+    public:
+        explicit writer_thread(int fd)
+            : _fd(fd), _thread([this] { run(); }) { }
+        
+        ~writer_thread()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closed = true;
+            }
+            _submitted.notify_one();
+            _thread.join();
+        }
+        
+        bool submit(unsigned slot, char const *data, size_t size,
+                    uint64_t offset) override
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            
+            job &j = _jobs[slot];
+            j.data = data;
+            j.size = size;
+            j.offset = offset;
+            j.pending = true;
+            j.ok = true;
+            
+            _queue.push_back(slot);
+            _submitted.notify_one();
+            
+            return true;
+        }
+        
+        bool wait(unsigned slot) override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _completed.wait(lock, [&] { return !_jobs[slot].pending; });
+            
+            return _jobs[slot].ok;
+        }
+        
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            
+            while(true) {
+                _submitted.wait(lock, [&] {
+                    return !_queue.empty() || _closed;
+                });
+                
+                if(_queue.empty())
+                    return;
+                
+                unsigned slot = _queue.front();
+                _queue.pop_front();
+                job j = _jobs[slot];
+                
+                lock.unlock();
+                bool ok = pwrite_all(_fd, j.data, j.size, j.offset);
+                lock.lock();
+                
+                _jobs[slot].ok = ok;
+                _jobs[slot].pending = false;
+                _completed.notify_all();
+            }
+        }
+        
+        int _fd;
+        job _jobs[2];
+        std::deque<unsigned> _queue;
+        bool _closed = false;
+        
+        std::mutex _mutex;
+        std::condition_variable _submitted;
+        std::condition_variable _completed;
+        std::thread _thread;
+    };
+    
+#ifdef OCMESH_HAVE_IO_URING
+    /*
+     * io_uring backend, driven directly through the system calls to avoid
+     * depending on liburing. The ring only needs an entry per buffer.
+     *
+     * Completions that write less than requested, or that fail because the
+     * kernel doesn't support the operation, are finished with pwrite().
+     */
+    class io_uring_ring : public async_filebuf::backend
+    {
+        struct job {
+            iovec iov;
+            uint64_t offset = 0;
+            bool pending = false;
+            bool ok = true;
+        };
+        
+    public:
+        explicit io_uring_ring(int fd) : _fd(fd) { }
+        
+        ~io_uring_ring()
+        {
+            if(_sqes)
+                ::munmap(_sqes, _sqes_size);
+            if(_cq_ring && _cq_ring != _sq_ring)
+                ::munmap(_cq_ring, _cq_ring_size);
+            if(_sq_ring)
+                ::munmap(_sq_ring, _sq_ring_size);
+            if(_ring >= 0)
+                ::close(_ring);
+        }
+        
+        bool setup()
+        {
+            io_uring_params p;
+            std::memset(&p, 0, sizeof(p));
+            
+            _ring = int(::syscall(__NR_io_uring_setup, 2, &p));
+            if(_ring < 0)
+                return false;
+            
+            _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _cq_ring_size = p.cq_off.cqes +
+                            p.cq_entries * sizeof(io_uring_cqe);
+            _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            
+            /*
+             * Kernels since 5.4 can map both rings at once. Headers older
+             * than that have neither the flag nor the features field, so
+             * the rings are mapped separately there.
+             */
+#ifdef IORING_FEAT_SINGLE_MMAP
+            bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+#else
+            bool single_mmap = false;
+#endif
+            if(single_mmap)
+                _sq_ring_size = _cq_ring_size =
+                    std::max(_sq_ring_size, _cq_ring_size);
+            
+            _sq_ring = map(_sq_ring_size, IORING_OFF_SQ_RING);
+            if(!_sq_ring)
+                return false;
+            
+            _cq_ring = single_mmap ? _sq_ring
+                                   : map(_cq_ring_size, IORING_OFF_CQ_RING);
+            if(!_cq_ring)
+                return false;
+            
+            _sqes = static_cast<io_uring_sqe *>(
+                map(_sqes_size, IORING_OFF_SQES));
+            if(!_sqes)
+                return false;
+            
+            char *sq = static_cast<char *>(_sq_ring);
+            _sq_tail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            _sq_mask  = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            _sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            
+            char *cq = static_cast<char *>(_cq_ring);
+            _cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            _cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            _cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            _cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+            
+            return true;
+        }
+        
+        bool submit(unsigned slot, char const *data, size_t size,
+                    uint64_t offset) override
+        {
+            job &j = _jobs[slot];
+            j.iov.iov_base = const_cast<char *>(data);
+            j.iov.iov_len = size;
+            j.offset = offset;
+            j.pending = true;
+            j.ok = true;
+            
+            unsigned tail = *_sq_tail;
+            unsigned index = tail & *_sq_mask;
+            
+            io_uring_sqe &sqe = _sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_WRITEV;
+            sqe.fd = _fd;
+            sqe.addr = reinterpret_cast<uint64_t>(&j.iov);
+            sqe.len = 1;
+            sqe.off = offset;
+            sqe.user_data = slot;
+            
+            _sq_array[index] = index;
+            __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+            
+            while(::syscall(__NR_io_uring_enter, _ring, 1, 0, 0,
+                            nullptr, 0) < 0)
+            {
+                if(errno != EINTR) {
+                    j.pending = false;
+                    return false;
+                }
+            }
+            
+            return true;
+        }
+        
+        bool wait(unsigned slot) override
+        {
+            while(_jobs[slot].pending) {
+                if(!reap())
+                    return false;
+            }
+            
+            return _jobs[slot].ok;
+        }
+        
+    private:
+        void *map(size_t size, off_t offset) {
+            void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, _ring, offset);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+        
+        // Consumes one completion, waiting for it if needed
+        bool reap()
+        {
+            unsigned head = *_cq_head;
+            while(head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+                if(::syscall(__NR_io_uring_enter, _ring, 0, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                   errno != EINTR)
+                    return false;
+            }
+            
+            io_uring_cqe cqe = _cqes[head & *_cq_mask];
+            __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+            
+            job &j = _jobs[cqe.user_data];
+            size_t written = cqe.res < 0 ? 0 : size_t(cqe.res);
+            char const *data = static_cast<char const *>(j.iov.iov_base);
+            
+            j.ok = pwrite_all(_fd, data + written, j.iov.iov_len - written,
+                              j.offset + written);
+            j.pending = false;
+            
+            return true;
+        }
+        
+        int _fd;
+        int _ring = -1;
+        job _jobs[2];
+        
+        void *_sq_ring = nullptr;
+        void *_cq_ring = nullptr;
+        size_t _sq_ring_size = 0;
+        size_t _cq_ring_size = 0;
+        size_t _sqes_size = 0;
+        
+        unsigned *_sq_tail = nullptr;
+        unsigned *_sq_mask = nullptr;
+        unsigned *_sq_array = nullptr;
+        io_uring_sqe *_sqes = nullptr;
+        
+        unsigned *_cq_head = nullptr;
+        unsigned *_cq_tail = nullptr;
+        unsigned *_cq_mask = nullptr;
+        io_uring_cqe *_cqes = nullptr;
+    };
+#endif
+    
+    async_filebuf::~async_filebuf()
+    {
+        close();
+    }
+    
+    bool async_filebuf::open(std::string const&path, size_t buffer_size)
+    {
+        if(is_open())
+            return false;
+        
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0644);
+        if(_fd < 0)
+            return false;
+        
+        _io_uring = false;
+        _failed = false;
+        _current = 0;
+        _offset = 0;
+        
+#ifdef OCMESH_HAVE_IO_URING
+        std::unique_ptr<io_uring_ring> ring(new io_uring_ring(_fd));
+        if(ring->setup()) {
+            _backend = std::move(ring);
+            _io_uring = true;
+        }
+#endif
+        if(!_backend)
+            _backend.reset(new writer_thread(_fd));
+        
+        for(auto &buffer : _buffers)
+            buffer.resize(buffer_size);
+        
+        setp(_buffers[0].data(), _buffers[0].data() + buffer_size);
+        
+        return true;
+    }
+    
+    bool async_filebuf::close()
+    {
+        if(!is_open())
+            return false;
+        
+        bool ok = drain();
+        
+        _backend.reset();
+        ok = ::close(_fd) == 0 && ok;
+        _fd = -1;
+        
+        for(auto &buffer : _buffers) {
+            buffer.clear();
+            buffer.shrink_to_fit();
+        }
+        setp(nullptr, nullptr);
+        
+        return ok;
+    }
+    
+    /*
+     * Submits the current buffer and switches to the other one, after
+     * waiting for its previous write to complete
+     */
+    bool async_filebuf::flip()
+    {
+        size_t size = size_t(pptr() - pbase());
+        
+        if(size > 0) {
+            if(!_backend->submit(_current, pbase(), size, _offset))
+                _failed = true;
+            _offset += size;
+            
+            _current = 1 - _current;
+            if(!_backend->wait(_current))
+                _failed = true;
+        }
+        
+        std::vector<char> &buffer = _buffers[_current];
+        setp(buffer.data(), buffer.data() + buffer.size());
+        
+        return !_failed;
+    }
+    
+    bool async_filebuf::drain()
+    {
+        flip();
+        
+        for(unsigned slot = 0; slot < 2; ++slot)
+            if(!_backend->wait(slot))
+                _failed = true;
+        
+        return !_failed;
+    }
+    
+    async_filebuf::int_type async_filebuf::overflow(int_type c)
+    {
+        if(!is_open() || !flip())
+            return traits_type::eof();
+        
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        
+        return traits_type::not_eof(c);
+    }
+    
+    int async_filebuf::sync()
+    {
+        if(!is_open())
+            return -1;
+        
+        return drain() ? 0 : -1;
+    }
+    
+} // namespace details
+} // namespace ocmesh
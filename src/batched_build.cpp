@@ -0,0 +1,175 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace ocmesh {
+namespace details {
+    
+    // Number of voxels classified by a single call of the split function
+    static const size_t batch_size = 4096;
+    
+    void octree::build_batched(batch_split_function_t split_function,
+                               unsigned threads)
+    {
+        build_levels([&](voxel::level_t level, uint64_t const *morton,
+                         size_t count, voxel::material_t *materials, float *) {
+            split_function(level, morton, count, materials);
+        }, threads, nullptr);
+    }
+    
+    /*
+     * When distances are requested, the ones of the leaves of each level
+     * are collected in the same order as the leaves, which are sorted.
+     * Since the final array is a merge of the leaves of all the levels,
+     * distances are then brought in leaf order by walking it with a
+     * cursor for each level.
+     */
+    void octree::build_levels(batch_sample_function_t const&split_function,
+                              unsigned threads, std::vector<float> *distances)
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        if(threads == 0)
+            threads = concurrency();
+        
+        _data.clear();
+        _attributes.clear();
+        
+        bool sparse = _storage == octree::sparse;
+        
+        std::vector<uint64_t> frontier = { 0 };
+        std::vector<uint64_t> next;
+        std::vector<voxel::material_t> materials;
+        std::vector<float> samples;
+        std::vector<std::vector<float>> level_distances(voxel::max_level + 1);
+        
+        // Per-batch counts of split voxels and leaves, then their offsets
+        std::vector<size_t> splits;
+        std::vector<size_t> leaves;
+        
+        for(uint8_t level = 0; !frontier.empty(); ++level)
+        {
+            size_t count = frontier.size();
+            size_t batches = (count + batch_size - 1) / batch_size;
+            
+            materials.resize(count);
+            if(distances)
+                samples.resize(count);
+            splits.assign(batches + 1, 0);
+            leaves.assign(batches + 1, 0);
+            
+            bool last = level == voxel::max_level;
+            
+            /*
+             * Classification
+             */
+            parallel_for(batches, [&](size_t b) {
+                size_t first = b * batch_size;
+                size_t n = std::min(batch_size, count - first);
+                
+                split_function(level, frontier.data() + first, n,
+                               materials.data() + first,
+                               distances ? samples.data() + first : nullptr);
+                
+                size_t s = 0, l = 0;
+                for(size_t i = first; i < first + n; ++i) {
+                    bool split = !last &&
+                                 materials[i] == voxel::unknown_material;
+                    s += split;
+                    l += !split &&
+                         !(sparse && materials[i] == voxel::void_material);
+                }
+                
+                splits[b + 1] = s;
+                leaves[b + 1] = l;
+            }, threads);
+            
+            /*
+             * Prefix sums give the position of the output of each batch
+             */
+            for(size_t b = 0; b < batches; ++b) {
+                splits[b + 1] += splits[b];
+                leaves[b + 1] += leaves[b];
+            }
+            
+            size_t base = _data.size();
+            _data.resize(base + leaves[batches]);
+            next.resize(8 * splits[batches]);
+            if(distances)
+                level_distances[level].resize(leaves[batches]);
+            
+            /*
+             * Compaction: leaves go to the octree, and the children of split
+             * voxels go to the next frontier, in Morton order
+             */
+            uint64_t step = last ? 0 : uint64_t(1) << (3 * (voxel::max_level - level - 1));
+            
+            parallel_for(batches, [&](size_t b) {
+                size_t first = b * batch_size;
+                size_t n = std::min(batch_size, count - first);
+                
+                uint64_t *child = next.data() + 8 * splits[b];
+                voxel *leaf = _data.data() + base + leaves[b];
+                float *distance = distances ?
+                    level_distances[level].data() + leaves[b] : nullptr;
+                
+                for(size_t i = first; i < first + n; ++i) {
+                    uint64_t m = frontier[i];
+                    
+                    if(!last && materials[i] == voxel::unknown_material) {
+                        for(uint64_t c = 0; c < 8; ++c)
+                            *child++ = m + c * step;
+                    } else if(!sparse ||
+                              materials[i] != voxel::void_material) {
+                        *leaf++ = voxel(m, level, materials[i]);
+                        if(distance)
+                            *distance++ = samples[i];
+                    }
+                }
+            }, threads);
+            
+            // Leaves of each level are sorted, so we only need to merge them
+            std::inplace_merge(_data.begin(), _data.begin() + ptrdiff_t(base),
+                               _data.end());
+            
+            frontier.swap(next);
+        }
+        
+        if(distances) {
+            std::vector<size_t> cursors(voxel::max_level + 1, 0);
+            
+            distances->resize(_data.size());
+            for(size_t i = 0; i < _data.size(); ++i) {
+                uint8_t level = _data[i].level();
+                (*distances)[i] = level_distances[level][cursors[level]++];
+            }
+        }
+        
+        _stats = build_stats();
+        _stats.threads = threads;
+        _stats.leaves = _data.size();
+        _stats.tasks = 1;
+        _stats.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,369 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Number of base cells covered by a voxel of the given height.
+     * Since the voxels tile the space in Morton order, a voxel covers
+     * exactly the range of Morton codes [morton, morton + span).
+     */
+    static uint64_t span(uint8_t height) {
+        return uint64_t(1) << (3 * height);
+    }
+    
+    static const uint64_t space = span(voxel::max_level);
+    
+    /*
+     * This class merges a sorted sequence of disjoint voxels bottom-up.
+     *
+     * Voxels are pushed on a stack. Whenever the last eight voxels on the
+     * stack are the complete set of children of the same parent and have
+     * the same material, they're replaced by the parent, and the check is
+     * repeated at the level above. Holes between the pushed voxels are
+     * filled with void voxels, which take part in the merging as well.
+     *
+     * Since merging siblings is confluent, running the merger again over
+     * the concatenation of already merged sequences completes the merges
+     * across their boundaries. This is what makes the parallel version work.
+     */
+    class merger
+    {
+    public:
+        explicit merger(uint64_t start = 0) : _next(start) { }
+        
+        void push(voxel v)
+        {
+            assert(v.material() != voxel::unknown_material);
+            assert(v.morton() >= _next && "Unsorted or overlapping voxels");
+            
+            fill(v.morton());
+            append(v);
+            _next = v.morton() + span(v.height());
+        }
+        
+        // Fills with void voxels everything up to the given Morton code
+        void fill(uint64_t end)
+        {
+            while(_next < end) {
+                uint8_t h = _next == 0 ? uint8_t(voxel::max_level)
+                          : uint8_t(std::min(size_t(__builtin_ctzll(_next) / 3),
+                                                     size_t(voxel::max_level)));
+                while(_next + span(h) > end)
+                    --h;
+                
+                append(voxel(_next, uint8_t(voxel::max_level - h),
+                             voxel::void_material));
+                _next += span(h);
+            }
+        }
+        
+        std::vector<voxel> &result() { return _stack; }
+        
+    private:
+        void append(voxel v)
+        {
+            _stack.push_back(v);
+            
+            while(_stack.size() >= 8) {
+                voxel first = _stack[_stack.size() - 8];
+                voxel last  = _stack.back();
+                
+                if(first.level() == 0 || first.level() != last.level())
+                    break;
+                
+                uint64_t s = span(first.height());
+                if(first.morton() % (8 * s) != 0 ||
+                   last.morton() != first.morton() + 7 * s)
+                    break;
+                
+                bool uniform = std::all_of(_stack.end() - 8, _stack.end(),
+                                           [&](voxel c) {
+                    return c.material() == first.material();
+                });
+                if(!uniform)
+                    break;
+                
+                _stack.resize(_stack.size() - 8);
+                _stack.push_back(first.with_level(first.level() - 1));
+            }
+        }
+        
+    private:
+        uint64_t _next;
+        std::vector<voxel> _stack;
+    };
+    
+    /*
+     * Number of levels of the top-level partition used to split the work
+     * among threads: we want a few tasks per thread to balance the load.
+     */
+    static uint8_t partition_depth(uint8_t max_depth) {
+        uint8_t depth = 0;
+        while(depth < max_depth && (size_t(1) << (3 * depth)) < 8 * concurrency())
+            ++depth;
+        return depth;
+    }
+    
+    /*
+     * Runs the given task for each cell of the top-level partition,
+     * and concatenates the results, in Morton order, in a final merger.
+     * The tasks and threads used are recorded in the given stats.
+     */
+    template<typename F>
+    static std::vector<voxel> merge_partitioned(uint8_t depth, F const&task,
+                                                build_stats &stats)
+    {
+        std::vector<std::vector<voxel>> parts(size_t(1) << (3 * depth));
+        
+        stats.tasks = parts.size();
+        stats.threads = unsigned(std::min<size_t>(concurrency(), parts.size()));
+        
+        parallel_for(parts.size(), [&](size_t i) {
+            parts[i] = task(i, parts.size());
+        });
+        
+        merger m;
+        for(std::vector<voxel> &part : parts) {
+            for(voxel v : part)
+                m.push(v);
+            std::vector<voxel>().swap(part);
+        }
+        
+        return std::move(m.result());
+    }
+    
+    void octree::build(std::vector<voxel> const&leaves)
+    {
+        assert(std::is_sorted(leaves.begin(), leaves.end()));
+        
+        auto start = std::chrono::steady_clock::now();
+        _stats = build_stats();
+        
+        auto task = [&](size_t i, size_t n) {
+            uint64_t lo = space / n * i;
+            uint64_t hi = space / n * (i + 1);
+            
+            auto by_morton = [](voxel v, uint64_t m) { return v.morton() < m; };
+            auto first = std::lower_bound(leaves.begin(), leaves.end(),
+                                          lo, by_morton);
+            auto last  = std::lower_bound(first, leaves.end(), hi, by_morton);
+            
+            // A coarse voxel of a previous part may cover the start of ours
+            uint64_t start = lo;
+            if(first != leaves.begin()) {
+                voxel prev = *(first - 1);
+                start = std::max(lo, prev.morton() + span(prev.height()));
+            }
+            
+            merger m(start);
+            std::for_each(first, last, [&](voxel v) { m.push(v); });
+            m.fill(hi);
+            
+            return std::move(m.result());
+        };
+        
+        std::vector<voxel> result =
+            merge_partitioned(partition_depth(voxel::max_level), task, _stats);
+        result.erase(drop_void(result.begin(), result.end()), result.end());
+        
+        _data.assign(result.begin(), result.end());
+        _attributes.clear();
+        
+        _stats.leaves = _data.size();
+        _stats.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    
+    /*
+     * Recursive walk of a dense volume in Morton order.
+     * Blocks that fall completely outside of the volume are emitted as
+     * single void voxels. Blocks of 2x2x2 cells entirely inside the volume
+     * are checked at once, which avoids most of the pushes on the merger
+     * in homogeneous regions.
+     */
+    template<typename Label>
+    class volume_walker
+    {
+    public:
+        volume_walker(volume const&vol, uint8_t level, merger &m)
+            : _dims(vol.dims()),
+              _cell(uint16_t(1) << (voxel::max_level - level)),
+              _labels(vol.data()),
+              _merger(m) { }
+        
+        // c is expressed in cells of the finest level, size in cells too
+        void walk(glm::u32vec3 c, uint32_t size, uint8_t level)
+        {
+            if(c.x >= _dims.x || c.y >= _dims.y || c.z >= _dims.z) {
+                emit(c, level, voxel::void_material);
+                return;
+            }
+            
+            if(size == 1) {
+                emit(c, level, label(c));
+                return;
+            }
+            
+            if(size == 2 &&
+               c.x + 1 < _dims.x && c.y + 1 < _dims.y && c.z + 1 < _dims.z)
+            {
+                Label l = load(index(c));
+                bool uniform = true;
+                for(uint32_t i = 1; i < 8 && uniform; ++i)
+                    uniform = load(index(c + child(i, 1))) == l;
+                
+                if(uniform) {
+                    emit(c, level, volume::material(l));
+                    return;
+                }
+            }
+            
+            uint32_t half = size / 2;
+            for(uint32_t i = 0; i < 8; ++i)
+                walk(c + child(i, half), half, level + 1);
+        }
+        
+    private:
+        static glm::u32vec3 child(uint32_t i, uint32_t half) {
+            return { (i & 1) * half, ((i >> 1) & 1) * half, (i >> 2) * half };
+        }
+        
+        size_t index(glm::u32vec3 c) const {
+            return (size_t(c.z) * _dims.y + c.y) * _dims.x + c.x;
+        }
+        
+        // The labels are bytes, so they're read like volume::label() does,
+        // without aliasing them with another type
+        Label load(size_t i) const {
+            Label value;
+            std::memcpy(&value, _labels + i * sizeof(Label), sizeof(Label));
+            return value;
+        }
+        
+        voxel::material_t label(glm::u32vec3 c) const {
+            return volume::material(load(index(c)));
+        }
+        
+        void emit(glm::u32vec3 c, uint8_t level, voxel::material_t material) {
+            glm::u16vec3 coordinates = glm::u16vec3(c * uint32_t(_cell));
+            _merger.push(voxel(coordinates, level, material));
+        }
+        
+    private:
+        glm::u32vec3 _dims;
+        uint16_t _cell;
+        uint8_t const *_labels;
+        merger &_merger;
+    };
+    
+    /*
+     * Largest label of a volume with 4-byte labels, scanned in parallel,
+     * each task on a range of labels
+     */
+    static uint32_t largest_label(volume const&vol)
+    {
+        static const size_t chunk = 1 << 16;
+        
+        size_t count = vol.size() / sizeof(uint32_t);
+        std::vector<uint32_t> largest((count + chunk - 1) / chunk, 0);
+        
+        parallel_for(largest.size(), [&](size_t t) {
+            size_t last = std::min(count, (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i) {
+                uint32_t l;
+                std::memcpy(&l, vol.data() + i * sizeof(l), sizeof(l));
+                largest[t] = std::max(largest[t], l);
+            }
+        });
+        
+        return largest.empty() ? 0
+                               : *std::max_element(largest.begin(),
+                                                   largest.end());
+    }
+    
+    template<typename Label>
+    static std::vector<voxel> merge_volume(volume const&vol,
+                                           build_stats &stats)
+    {
+        glm::u32vec3 dims = vol.dims();
+        uint32_t side = std::max({ dims.x, dims.y, dims.z, 1u });
+        
+        // Level of the cells of the volume
+        uint8_t level = 0;
+        while((uint32_t(1) << level) < side)
+            ++level;
+        
+        uint8_t depth = partition_depth(level);
+        
+        auto task = [&](size_t i, size_t) {
+            uint32_t size = uint32_t(1) << (level - depth);
+            glm::u32vec3 c = unmorton(i) * size;
+            
+            merger m(i * span(voxel::max_level - depth));
+            volume_walker<Label>(vol, level, m).walk(c, size, depth);
+            
+            return std::move(m.result());
+        };
+        
+        return merge_partitioned(depth, task, stats);
+    }
+    
+    bool octree::build(volume const&vol)
+    {
+        auto start = std::chrono::steady_clock::now();
+        _stats = build_stats();
+        
+        _data.clear();
+        _attributes.clear();
+        
+        std::vector<voxel> result;
+        
+        // Labels of 1 or 2 bytes always fit in the materials
+        switch(vol.label_bytes()) {
+            case 1:
+                result = merge_volume<uint8_t>(vol, _stats);
+                break;
+            case 2:
+                result = merge_volume<uint16_t>(vol, _stats);
+                break;
+            default:
+                if(largest_label(vol) > volume::max_label)
+                    return false;
+                result = merge_volume<uint32_t>(vol, _stats);
+                break;
+        }
+        result.erase(drop_void(result.begin(), result.end()), result.end());
+        
+        _data.assign(result.begin(), result.end());
+        
+        _stats.leaves = _data.size();
+        _stats.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        
+        return true;
+    }
+    
+} // namespace details
+} // namespace ocmesh
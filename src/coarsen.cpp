@@ -0,0 +1,230 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Volume of a voxel, expressed in base units
+     */
+    static uint64_t volume(voxel v) {
+        return uint64_t(1) << (3 * v.height());
+    }
+    
+    /*
+     * Accumulates the volume covered by each material in a range of leaves.
+     * The number of distinct materials in a single cell is usually tiny,
+     * so a flat vector is better than any map here.
+     * The part of the cell not covered by any leaf, which can happen in
+     * sparse octrees, is accounted as void.
+     */
+    static std::vector<std::pair<voxel::material_t, uint64_t>>
+    volumes(voxel cell,
+            octree::const_iterator first, octree::const_iterator last)
+    {
+        std::vector<std::pair<voxel::material_t, uint64_t>> result;
+        
+        auto add = [&](voxel::material_t material, uint64_t volume) {
+            auto p = std::find_if(result.begin(), result.end(),
+                                  [&](std::pair<voxel::material_t, uint64_t> e) {
+                return e.first == material;
+            });
+            
+            if(p == result.end())
+                result.emplace_back(material, volume);
+            else
+                p->second += volume;
+        };
+        
+        uint64_t covered = 0;
+        for(auto it = first; it != last; ++it) {
+            add(it->material(), volume(*it));
+            covered += volume(*it);
+        }
+        
+        if(covered < volume(cell))
+            add(voxel::void_material, volume(cell) - covered);
+        
+        return result;
+    }
+    
+    static voxel::material_t majority(voxel cell,
+                                      octree::const_iterator first,
+                                      octree::const_iterator last)
+    {
+        auto v = volumes(cell, first, last);
+        
+        return std::max_element(v.begin(), v.end(),
+                                [](std::pair<voxel::material_t, uint64_t> a,
+                                   std::pair<voxel::material_t, uint64_t> b) {
+            // Ties go to the lowest material, for determinism
+            return a.second < b.second ||
+                   (a.second == b.second && a.first > b.first);
+        })->first;
+    }
+    
+    octree::coarsen_function_t octree::majority_rule() {
+        return [](voxel cell, const_iterator first, const_iterator last) {
+            return majority(cell, first, last);
+        };
+    }
+    
+    octree::coarsen_function_t
+    octree::priority_rule(std::vector<voxel::material_t> order)
+    {
+        return [order](voxel cell, const_iterator first, const_iterator last) {
+            auto best = order.end();
+            for(auto e : volumes(cell, first, last)) {
+                auto p = std::find(order.begin(), best, e.first);
+                if(p != best)
+                    best = p;
+            }
+            
+            return best != order.end() ? *best : majority(cell, first, last);
+        };
+    }
+    
+    octree::coarsen_function_t octree::keep_refined_rule() {
+        return [](voxel, const_iterator, const_iterator) {
+            return voxel::unknown_material;
+        };
+    }
+    
+    /*
+     * This class implements the coarsening at a given level.
+     * Leaves have to be fed in Morton order. Since the leaves covered by a
+     * cell at the target level are contiguous in the sorted array, we only
+     * have to remember where the current group of leaves starts and whether
+     * all of them have the same material so far.
+     */
+    class coarsener
+    {
+    public:
+        coarsener(octree const&source, octree &target,
+                  voxel::level_t level, octree::coarsen_function_t const&rule)
+            : _source(source), _target(target), _level(level), _rule(rule)
+        {
+            _target._storage = source._storage;
+            _target._transform = source._transform;
+        }
+        
+        void feed(octree::const_iterator it)
+        {
+            voxel v = *it;
+            
+            if(v.level() <= _level) {
+                flush(it);
+                _target._data.push_back(v);
+                return;
+            }
+            
+            uint64_t mask = lowmask(3 * (voxel::max_level - _level));
+            uint64_t ancestor = v.morton() & ~mask;
+            
+            if(_active && ancestor == _ancestor) {
+                _uniform = _uniform && v.material() == _material;
+                _covered += volume(v);
+                return;
+            }
+            
+            flush(it);
+            
+            _active = true;
+            _first = it;
+            _ancestor = ancestor;
+            _material = v.material();
+            _uniform = true;
+            _covered = volume(v);
+        }
+        
+        void finish() {
+            flush(_source.end());
+        }
+        
+    private:
+        void flush(octree::const_iterator last)
+        {
+            if(!_active)
+                return;
+            
+            _active = false;
+            
+            voxel cell(_ancestor, _level, voxel::unknown_material);
+            
+            // In sparse octrees, missing leaves are void
+            bool uniform = _uniform && _covered == volume(cell);
+            
+            voxel::material_t material =
+                uniform ? _material : _rule(cell, _first, last);
+            
+            if(material == voxel::unknown_material)
+                _target._data.insert(_target._data.end(), _first, last);
+            else if(_target._storage == octree::dense ||
+                    material != voxel::void_material)
+                _target._data.push_back(cell.with_material(material));
+        }
+        
+    private:
+        octree const&_source;
+        octree &_target;
+        voxel::level_t _level;
+        octree::coarsen_function_t const&_rule;
+        
+        // State of the current group of leaves
+        bool _active = false;
+        octree::const_iterator _first;
+        uint64_t _ancestor = 0;
+        voxel::material_t _material = voxel::unknown_material;
+        bool _uniform = true;
+        uint64_t _covered = 0;
+    };
+    
+    octree octree::coarsen(voxel::level_t level,
+                           coarsen_function_t rule) const
+    {
+        return std::move(lod({ level }, std::move(rule)).front());
+    }
+    
+    std::vector<octree>
+    octree::lod(std::vector<voxel::level_t> const&levels,
+                coarsen_function_t rule) const
+    {
+        std::vector<octree> result(levels.size());
+        std::vector<coarsener> coarseners;
+        
+        coarseners.reserve(levels.size());
+        for(size_t i = 0; i < levels.size(); ++i) {
+            assert(levels[i] <= voxel::max_level && "Level out of range");
+            coarseners.emplace_back(*this, result[i], levels[i], rule);
+        }
+        
+        for(auto it = begin(); it != end(); ++it)
+            for(coarsener &c : coarseners)
+                c.feed(it);
+        
+        for(coarsener &c : coarseners)
+            c.finish();
+        
+        return result;
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,402 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "components.h"
+#include "face_contacts.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+
+namespace ocmesh {
+namespace details {
+    
+    // Leaves visited by each parallel task
+    static const size_t chunk = 1 << 12;
+    
+    /*
+     * Disjoint sets of indices, which can be merged concurrently without
+     * locks. A root is linked to another one with a compare-and-swap, which
+     * fails if some other thread linked it first, in which case the roots
+     * are looked up again. Roots are always linked to the smaller one, so
+     * each set has the smallest of its indices as root.
+     */
+    class disjoint_sets
+    {
+    public:
+        explicit disjoint_sets(size_t size) : _parent(size) { }
+        
+        void reset(size_t x) {
+            _parent[x].store(x, std::memory_order_relaxed);
+        }
+        
+        size_t find(size_t x)
+        {
+            while(true) {
+                size_t p = _parent[x].load(std::memory_order_relaxed);
+                if(p == x)
+                    return x;
+                
+                // Path halving: x skips its parent, if it has a grandparent
+                size_t g = _parent[p].load(std::memory_order_relaxed);
+                if(g != p)
+                    _parent[x].compare_exchange_weak(p, g,
+                                                     std::memory_order_relaxed);
+                x = g;
+            }
+        }
+        
+        void unite(size_t a, size_t b)
+        {
+            while(true) {
+                a = find(a);
+                b = find(b);
+                if(a == b)
+                    return;
+                
+                if(a < b)
+                    std::swap(a, b);
+                
+                size_t root = a;
+                if(_parent[a].compare_exchange_strong(root, b,
+                                                      std::memory_order_relaxed))
+                    return;
+            }
+        }
+    
+    private:
+        std::vector<std::atomic<size_t>> _parent;
+    };
+    
+    /*
+     * Leaves of a sparse octree, together with the largest Morton-aligned
+     * cubes of void that cover the missing ranges, in Morton order
+     */
+    static std::vector<voxel> cover(octree const&oc)
+    {
+        std::vector<voxel> cells;
+        uint64_t covered = 0;
+        
+        auto fill = [&](uint64_t last) {
+            while(covered < last) {
+                uint8_t height = 0;
+                while(height < voxel::max_level) {
+                    uint64_t span = uint64_t(1) << (3 * (height + 1));
+                    if(covered % span != 0 || covered + span > last)
+                        break;
+                    ++height;
+                }
+                
+                cells.push_back(voxel(covered,
+                                      voxel::level_t(voxel::max_level - height),
+                                      voxel::void_material));
+                covered += uint64_t(1) << (3 * height);
+            }
+        };
+        
+        for(voxel v : oc) {
+            fill(v.morton());
+            cells.push_back(v);
+            covered = v.morton() + (uint64_t(1) << (3 * v.height()));
+        }
+        fill(uint64_t(1) << voxel::location_bits);
+        
+        return cells;
+    }
+    
+    // The cell containing the base cell with the given Morton code
+    static size_t locate(voxel const *cells, size_t count, uint64_t m)
+    {
+        voxel const *it = std::upper_bound(cells, cells + count, m,
+                                           [](uint64_t code, voxel v) {
+            return code < v.morton();
+        });
+        
+        return size_t(it - cells) - 1;
+    }
+    
+    /*
+     * Calls f(i) for each cell touching the positive face, along the given
+     * axis, of a cell of the given level, where cube is the cube of the
+     * same level across the face
+     */
+    template<typename F>
+    static void across(voxel const *cells, size_t count, uint8_t axis,
+                       glm::u32vec3 cube, voxel::level_t level, F const&f)
+    {
+        size_t i = locate(cells, count, morton(cube));
+        if(cells[i].level() <= level) {
+            f(i);
+            return;
+        }
+        
+        // The cube is subdivided: go down to the half facing the cell
+        uint32_t half = uint32_t(1) << (voxel::max_level - level - 1);
+        uint8_t u = (axis + 1) % 3, w = (axis + 2) % 3;
+        
+        for(uint32_t c = 0; c < 4; ++c) {
+            glm::u32vec3 child = cube;
+            child[u] += (c & 1) * half;
+            child[w] += (c >> 1) * half;
+            
+            across(cells, count, axis, child, voxel::level_t(level + 1), f);
+        }
+    }
+    
+    material_components::material_components(octree const&oc,
+                                             unsigned threads)
+    {
+        bool sparse = oc.storage() == octree::sparse;
+        
+        std::vector<voxel> gaps;
+        voxel const *cells = oc.empty() ? nullptr : &*oc.begin();
+        size_t count = oc.size();
+        if(sparse) {
+            gaps = cover(oc);
+            cells = gaps.data();
+            count = gaps.size();
+        }
+        
+        disjoint_sets sets(count);
+        size_t tasks = (count + chunk - 1) / chunk;
+        
+        parallel_for(tasks, [&](size_t t) {
+            size_t last = std::min(count, (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i)
+                sets.reset(i);
+        }, threads);
+        
+        // Each contact is found from the cell on its negative side
+        parallel_for(tasks, [&](size_t t) {
+            size_t last = std::min(count, (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i) {
+                voxel v = cells[i];
+                glm::u32vec3 origin(v.coordinates());
+                uint32_t size = v.size();
+                
+                for(uint8_t axis = 0; axis < 3; ++axis) {
+                    if(origin[axis] + size > voxel::max_coordinate)
+                        continue;
+                    
+                    glm::u32vec3 cube = origin;
+                    cube[axis] += size;
+                    
+                    across(cells, count, axis, cube, v.level(),
+                           [&](size_t j) {
+                        if(cells[j].material() == v.material())
+                            sets.unite(i, j);
+                    });
+                }
+            }
+        }, threads);
+        
+        /*
+         * Numbering of the components, in the order of their roots, which
+         * are their first cells
+         */
+        std::vector<size_t> labels(count);
+        for(size_t i = 0; i < count; ++i) {
+            voxel v = cells[i];
+            size_t root = sets.find(i);
+            if(root == i) {
+                labels[i] = _components.size();
+                _components.push_back(component{ v.material(), 0, 0, false });
+            } else
+                labels[i] = labels[root];
+            
+            component &c = _components[labels[i]];
+            c.volume += uint64_t(1) << (3 * v.height());
+            
+            glm::u32vec3 origin(v.coordinates());
+            for(uint8_t axis = 0; axis < 3; ++axis)
+                if(origin[axis] == 0 ||
+                   origin[axis] + v.size() > voxel::max_coordinate)
+                    c.border = true;
+            
+            // The leaves of sparse octrees are never void
+            if(!sparse || v.material() != voxel::void_material) {
+                ++c.leaves;
+                if(sparse)
+                    _labels.push_back(labels[i]);
+            }
+        }
+        
+        if(!sparse)
+            _labels = std::move(labels);
+    }
+    
+    size_t material_components::count(voxel::material_t material) const
+    {
+        return size_t(std::count_if(_components.begin(), _components.end(),
+                                    [&](component const&c) {
+            return c.material == material;
+        }));
+    }
+    
+    std::vector<size_t> material_components::cavities() const
+    {
+        std::vector<size_t> result;
+        for(size_t i = 0; i < _components.size(); ++i)
+            if(_components[i].material == voxel::void_material &&
+               !_components[i].border)
+                result.push_back(i);
+        
+        return result;
+    }
+    
+    void material_components::write_json(std::ostream &out) const
+    {
+        // Components, and the ones not touching the border, by material
+        std::map<voxel::material_t, std::pair<size_t, size_t>> materials;
+        for(component const&c : _components) {
+            auto &m = materials[c.material];
+            ++m.first;
+            m.second += !c.border;
+        }
+        
+        out << "{\n  \"materials\": [";
+        size_t i = 0;
+        for(auto const&m : materials)
+            out << (i++ ? ",\n" : "\n")
+                << "    { \"material\": " << m.first
+                << ", \"components\": " << m.second.first
+                << ", \"enclosed\": " << m.second.second << " }";
+        
+        out << "\n  ],\n  \"components\": [";
+        for(i = 0; i < _components.size(); ++i) {
+            component const&c = _components[i];
+            out << (i ? ",\n" : "\n")
+                << "    { \"material\": " << c.material
+                << ", \"leaves\": " << c.leaves
+                << ", \"volume\": " << c.volume
+                << ", \"border\": " << (c.border ? "true" : "false") << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+    
+    size_t drop_fragments(octree &oc, material_components const&components,
+                          uint64_t min_volume)
+    {
+        auto const&list = components.components();
+        auto const&labels = components.labels();
+        assert(labels.size() == oc.size() && "Components of another octree");
+        
+        bool sparse = oc.storage() == octree::sparse;
+        voxel::material_t empty = voxel::void_material;
+        
+        auto small = [&](size_t label) {
+            return list[label].volume < min_volume;
+        };
+        
+        /*
+         * Area shared by each small component with each of its neighbours.
+         * Void across a face of a sparse octree has no component, and it's
+         * kept, unless it's the outside of the domain.
+         */
+        size_t gap = size_t(-1);
+        std::map<size_t, std::map<size_t, uint64_t>> areas;
+        for(size_t i = 0; i < labels.size(); ++i) {
+            if(!small(labels[i]))
+                continue;
+            
+            auto &area = areas[labels[i]];
+            for_each_contact(oc, oc.begin() + i, [&](face_contact const&c) {
+                uint64_t a = uint64_t(c.size) * c.size;
+                if(c.neighbour != oc.end()) {
+                    size_t label = labels[size_t(c.neighbour - oc.begin())];
+                    if(label != labels[i])
+                        area[label] += a;
+                    return;
+                }
+                
+                uint32_t plane = c.origin[c.side / 2];
+                bool outside = plane == 0 || plane > voxel::max_coordinate;
+                if(sparse && !outside)
+                    area[gap] += a;
+            });
+        }
+        
+        /*
+         * Small components are resolved outwards from the kept ones, a
+         * layer at a time, like a breadth-first visit: each layer takes
+         * the ones touching a kept or already resolved component, and each
+         * of them follows what those neighbours are, or have become. A
+         * fragment inside a small cavity, then, follows the cavity once it
+         * is filled. Components that can't reach any kept one become void.
+         */
+        std::map<size_t, voxel::material_t> targets;
+        while(true) {
+            std::map<size_t, voxel::material_t> layer;
+            for(auto &component : areas) {
+                if(targets.count(component.first))
+                    continue;
+                
+                std::map<voxel::material_t, uint64_t> materials;
+                for(auto const&area : component.second) {
+                    if(area.first == gap)
+                        materials[empty] += area.second;
+                    else if(!small(area.first))
+                        materials[list[area.first].material] += area.second;
+                    else if(targets.count(area.first))
+                        materials[targets[area.first]] += area.second;
+                }
+                
+                voxel::material_t target = empty;
+                uint64_t largest = 0;
+                for(auto const&m : materials)
+                    if(m.second > largest) {
+                        largest = m.second;
+                        target = m.first;
+                    }
+                
+                if(largest > 0)
+                    layer[component.first] = target;
+            }
+            
+            if(layer.empty())
+                break;
+            targets.insert(layer.begin(), layer.end());
+        }
+        
+        for(auto const&component : areas)
+            if(!targets.count(component.first))
+                targets[component.first] = empty;
+        
+        size_t changed = 0;
+        bool dropped = false;
+        for(size_t i = 0; i < labels.size(); ++i) {
+            if(!small(labels[i]))
+                continue;
+            
+            octree::iterator it = oc.begin() + i;
+            voxel::material_t target = targets[labels[i]];
+            if(it->material() == target)
+                continue;
+            
+            *it = it->with_material(target);
+            dropped = dropped || target == empty;
+            ++changed;
+        }
+        
+        // Drops the leaves that became void, with their attributes
+        if(sparse && dropped)
+            oc.sparsify();
+        
+        return changed;
+    }
+    
+} // namespace details
+} // namespace ocmesh
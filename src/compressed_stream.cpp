@@ -0,0 +1,243 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef OCMESH_HAVE_ZLIB
+
+#include "compressed_stream.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+namespace ocmesh {
+namespace details {
+    
+    constexpr size_t compressed_streambuf::default_block_size;
+    
+    // Size of the deflate window, and so of the useful dictionary
+    static const size_t window_size = size_t(32) << 10;
+    
+    /*
+     * Result of the compression of a single block
+     */
+    struct compressed_block {
+        std::vector<char> data;
+        uint32_t check = 0;
+        bool ok = true;
+    };
+    
+    /*
+     * Raw deflate of a block, terminated by a sync flush so that the next
+     * block can follow it in the same stream
+     */
+    static void deflate_block(char const *data, size_t size,
+                              char const *dictionary, size_t dictionary_size,
+                              int level, compressed_block &block)
+    {
+        z_stream z;
+        z.zalloc = Z_NULL;
+        z.zfree = Z_NULL;
+        z.opaque = Z_NULL;
+        
+        if(deflateInit2(&z, level, Z_DEFLATED, -15, 8,
+                        Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            block.ok = false;
+            return;
+        }
+        
+        if(dictionary_size > 0)
+            deflateSetDictionary(&z, reinterpret_cast<Bytef const *>(dictionary),
+                                 uInt(dictionary_size));
+        
+        // The bound doesn't count the empty block emitted by the sync flush
+        block.data.resize(deflateBound(&z, uLong(size)) + 16);
+        
+        z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        z.avail_in = uInt(size);
+        z.next_out = reinterpret_cast<Bytef *>(block.data.data());
+        z.avail_out = uInt(block.data.size());
+        
+        int result = deflate(&z, Z_SYNC_FLUSH);
+        block.ok = result == Z_OK && z.avail_in == 0 && z.avail_out > 0;
+        block.data.resize(z.total_out);
+        
+        deflateEnd(&z);
+    }
+    
+    static uint32_t checksum(compressed_streambuf::format_t format,
+                             char const *data, size_t size)
+    {
+        Bytef const *bytes = reinterpret_cast<Bytef const *>(data);
+        
+        if(format == compressed_streambuf::gzip)
+            return uint32_t(crc32(crc32(0, Z_NULL, 0), bytes, uInt(size)));
+        
+        return uint32_t(adler32(adler32(0, Z_NULL, 0), bytes, uInt(size)));
+    }
+    
+    compressed_streambuf::compressed_streambuf(std::ostream &out,
+                                               format_t format, int level,
+                                               unsigned threads,
+                                               size_t block_size)
+        : _out(out), _format(format), _level(level),
+          _threads(std::max(threads, 1u)),
+          _block_size(std::max(block_size, window_size))
+    {
+        _check = checksum(format, nullptr, 0);
+        
+        // Two blocks per thread help to balance the work
+        _input.resize(_block_size * _threads * 2);
+        setp(_input.data(), _input.data() + _input.size());
+        
+        header();
+    }
+    
+    compressed_streambuf::~compressed_streambuf()
+    {
+        finish();
+    }
+    
+    bool compressed_streambuf::finish()
+    {
+        if(_finished)
+            return bool(_out);
+        
+        bool ok = compress_batch();
+        
+        trailer();
+        _finished = true;
+        
+        _input.clear();
+        _input.shrink_to_fit();
+        setp(nullptr, nullptr);
+        
+        return ok && _out;
+    }
+    
+    compressed_streambuf::int_type compressed_streambuf::overflow(int_type c)
+    {
+        if(_finished || !compress_batch())
+            return traits_type::eof();
+        
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        
+        return traits_type::not_eof(c);
+    }
+    
+    /*
+     * Compresses the buffered blocks in parallel, writes them out and
+     * updates the checksum
+     */
+    bool compressed_streambuf::compress_batch()
+    {
+        size_t size = size_t(pptr() - pbase());
+        size_t count = (size + _block_size - 1) / _block_size;
+        
+        std::vector<compressed_block> blocks(count);
+        
+        parallel_for(count, [&](size_t i) {
+            char const *data = _input.data() + i * _block_size;
+            size_t length = std::min(_block_size, size - i * _block_size);
+            
+            char const *dictionary = i > 0 ? data - window_size
+                                           : _dictionary.data();
+            size_t dictionary_size = i > 0 ? window_size : _dictionary.size();
+            
+            deflate_block(data, length, dictionary, dictionary_size, _level,
+                          blocks[i]);
+            
+            blocks[i].check = checksum(_format, data, length);
+        }, _threads);
+        
+        bool ok = true;
+        for(size_t i = 0; i < count; ++i) {
+            compressed_block const&block = blocks[i];
+            size_t length = std::min(_block_size, size - i * _block_size);
+            
+            ok = ok && block.ok;
+            _out.write(block.data.data(), std::streamsize(block.data.size()));
+            
+            _check = _format == gzip
+                ? crc32_combine(_check, block.check, z_off_t(length))
+                : adler32_combine(_check, block.check, z_off_t(length));
+        }
+        _length += size;
+        
+        if(size > 0) {
+            size_t keep = std::min(window_size, size);
+            _dictionary.assign(pptr() - keep, pptr());
+        }
+        
+        setp(_input.data(), _input.data() + _input.size());
+        
+        return ok && _out;
+    }
+    
+    static void put_le32(std::ostream &out, uint32_t value) {
+        for(int i = 0; i < 4; ++i)
+            out.put(char((value >> (8 * i)) & 0xff));
+    }
+    
+    static void put_be32(std::ostream &out, uint32_t value) {
+        for(int i = 3; i >= 0; --i)
+            out.put(char((value >> (8 * i)) & 0xff));
+    }
+    
+    void compressed_streambuf::header()
+    {
+        if(_format == gzip) {
+            // Magic, deflate method, no flags, no time, no extra flags, Unix
+            static const char head[] = {
+                '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3
+            };
+            _out.write(head, sizeof(head));
+            return;
+        }
+        
+        // Deflate with a 32K window, and the level hint of the RFC
+        bool standard = _level == 6 || _level == Z_DEFAULT_COMPRESSION;
+        unsigned hint = standard    ? 2 :
+                        _level <= 1 ? 0 :
+                        _level <= 5 ? 1 : 3;
+        unsigned head = (0x78 << 8) | (hint << 6);
+        head += 31 - head % 31;
+        
+        _out.put(char(head >> 8));
+        _out.put(char(head & 0xff));
+    }
+    
+    void compressed_streambuf::trailer()
+    {
+        // Empty final block with fixed codes, to end the deflate stream
+        _out.put('\x03');
+        _out.put('\x00');
+        
+        if(_format == gzip) {
+            put_le32(_out, _check);
+            put_le32(_out, uint32_t(_length));
+        } else {
+            put_be32(_out, _check);
+        }
+    }
+    
+} // namespace details
+} // namespace ocmesh
+
+#endif // OCMESH_HAVE_ZLIB
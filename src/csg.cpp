@@ -19,6 +19,7 @@
 #include <ostream>
 #include <algorithm>
 #include <numeric>
+#include <vector>
 #include <cmath>
 
 namespace ocmesh {
@@ -28,10 +29,24 @@ namespace ocmesh {
         object::~object() = default;
         binary_operation_t::~binary_operation_t() = default;
         
+        void object::distances(glm::vec3 const *from, float *result,
+                               size_t count)
+        {
+            for(size_t i = 0; i < count; ++i)
+                result[i] = distance(from[i]);
+        }
+        
         float sphere_t::distance(glm::vec3 const&from) {
             return glm::length(from) - _radius;
         }
         
+        void sphere_t::distances(glm::vec3 const *from, float *result,
+                                 size_t count)
+        {
+            for(size_t i = 0; i < count; ++i)
+                result[i] = glm::length(from[i]) - _radius;
+        }
+        
         bounding_box sphere_t::bounding_box() const
         {
             glm::vec3 left_bottom_back = { -radius(), -radius(), -radius() };
@@ -50,6 +65,15 @@ namespace ocmesh {
                              std::abs(from.z)}) - _side / 2;
         }
         
+        void cube_t::distances(glm::vec3 const *from, float *result,
+                               size_t count)
+        {
+            for(size_t i = 0; i < count; ++i)
+                result[i] = std::max({std::abs(from[i].x),
+                                      std::abs(from[i].y),
+                                      std::abs(from[i].z)}) - _side / 2;
+        }
+        
         bounding_box cube_t::bounding_box() const {
             float half = side() / 2;
             
@@ -67,6 +91,12 @@ namespace ocmesh {
             return _child->distance(from);
         }
         
+        void toplevel_t::distances(glm::vec3 const *from, float *result,
+                                   size_t count)
+        {
+            _child->distances(from, result, count);
+        }
+        
         bounding_box toplevel_t::bounding_box() const {
             return _child->bounding_box();
         }
@@ -89,6 +119,21 @@ namespace ocmesh {
             return std::min(left()->distance(from), right()->distance(from));
         }
         
+        /*
+         * Binary operations evaluate the left child directly into the
+         * result, and the right one into a scratch buffer, then combine them
+         */
+        void union_t::distances(glm::vec3 const *from, float *result,
+                                size_t count)
+        {
+            std::vector<float> rhs(count);
+            left()->distances(from, result, count);
+            right()->distances(from, rhs.data(), count);
+            
+            for(size_t i = 0; i < count; ++i)
+                result[i] = std::min(result[i], rhs[i]);
+        }
+        
         /*
          * Component-wise min/max functions, useful for bounding boxes
          */
@@ -142,6 +187,17 @@ namespace ocmesh {
             return std::max(left()->distance(from), right()->distance(from));
         }
         
+        void intersection_t::distances(glm::vec3 const *from, float *result,
+                                       size_t count)
+        {
+            std::vector<float> rhs(count);
+            left()->distances(from, result, count);
+            right()->distances(from, rhs.data(), count);
+            
+            for(size_t i = 0; i < count; ++i)
+                result[i] = std::max(result[i], rhs[i]);
+        }
+        
         /*
          * TODO: find a better intersection bounding box
          */
@@ -161,6 +217,17 @@ namespace ocmesh {
             return std::max(left()->distance(from), - right()->distance(from));
         }
         
+        void difference_t::distances(glm::vec3 const *from, float *result,
+                                     size_t count)
+        {
+            std::vector<float> rhs(count);
+            left()->distances(from, result, count);
+            right()->distances(from, rhs.data(), count);
+            
+            for(size_t i = 0; i < count; ++i)
+                result[i] = std::max(result[i], - rhs[i]);
+        }
+        
         void difference_t::dump(std::ostream &o) const {
             o << "subtract(";
             left()->dump(o);
@@ -180,6 +247,19 @@ namespace ocmesh {
             return child()->distance((world_to_object() * v).xyz());
         }
         
+        void transform_t::distances(glm::vec3 const *from, float *result,
+                                    size_t count)
+        {
+            std::vector<glm::vec3> local(count);
+            
+            for(size_t i = 0; i < count; ++i) {
+                glm::vec4 v = { from[i].x, from[i].y, from[i].z, 1.0f };
+                local[i] = (world_to_object() * v).xyz();
+            }
+            
+            child()->distances(local.data(), result, count);
+        }
+        
         /*
          * Axis-aligned bounding box of a transformed axis-aligned bounding box
          *
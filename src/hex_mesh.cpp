@@ -0,0 +1,421 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hex_mesh.h"
+#include "hexahedra.h"
+#include "face_contacts.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace ocmesh {
+namespace details {
+    
+    // Nodes or elements processed by each parallel task
+    static const size_t chunk = 1 << 14;
+    
+    /*
+     * Nodes of each face of an element, as positions in its connectivity,
+     * in the order of the voxel::face enumeration
+     */
+    static const uint8_t face_nodes[6][4] = {
+        { 0, 4, 7, 3 }, // Left
+        { 1, 2, 6, 5 }, // Right
+        { 0, 1, 5, 4 }, // Bottom
+        { 3, 7, 6, 2 }, // Top
+        { 0, 3, 2, 1 }, // Back
+        { 4, 5, 6, 7 }  // Front
+    };
+    
+    hex_mesh::hex_mesh(octree const&oc, bool boundary)
+        : hex_mesh(oc, [=] {
+            hex_mesh_options options;
+            options.boundary = boundary;
+            return options;
+        }()) { }
+    
+    hex_mesh::hex_mesh(octree const&oc, hex_mesh_options const&options)
+    {
+        std::vector<voxel> solid;
+        std::vector<size_t> leaves; // Position of each element in the octree
+        for(auto it = oc.begin(); it != oc.end(); ++it) {
+            assert(it->material() != voxel::unknown_material);
+            if(it->material() != voxel::void_material) {
+                solid.push_back(*it);
+                leaves.push_back(size_t(it - oc.begin()));
+            }
+        }
+        
+        hexahedra hexes = make_hexahedra(solid.data(), solid.size());
+        
+        _coordinates.resize(hexes.nodes.size() * 3);
+        parallel_for((hexes.nodes.size() + chunk - 1) / chunk, [&](size_t t) {
+            size_t last = std::min(hexes.nodes.size(), (t + 1) * chunk);
+            for(size_t n = t * chunk; n < last; ++n) {
+                glm::u32vec3 p = hexes.position(n);
+                _coordinates[n * 3 + 0] = p.x;
+                _coordinates[n * 3 + 1] = p.y;
+                _coordinates[n * 3 + 2] = p.z;
+            }
+        });
+        
+        _connectivity = std::move(hexes.connectivity);
+        
+        _materials.resize(solid.size());
+        for(size_t e = 0; e < solid.size(); ++e)
+            _materials[e] = solid[e].material();
+        
+        if(options.boundary)
+            find_boundary(oc, leaves);
+        
+        if(options.adjacency) {
+            find_constraints(oc, leaves, hexes.nodes);
+            find_adjacency();
+        }
+    }
+    
+    void hex_mesh::find_boundary(octree const&oc,
+                                 std::vector<size_t> const&leaves)
+    {
+        size_t tasks = (leaves.size() + chunk - 1) / chunk;
+        std::vector<std::vector<boundary_face>> found(tasks);
+        
+        parallel_for(tasks, [&](size_t t) {
+            size_t last = std::min(leaves.size(), (t + 1) * chunk);
+            for(size_t e = t * chunk; e < last; ++e) {
+                bool exposed[6] = { };
+                
+                for_each_contact(oc, oc.begin() + ptrdiff_t(leaves[e]),
+                                 [&](face_contact const&c) {
+                    if(c.neighbour == oc.end() ||
+                       c.neighbour->material() == voxel::void_material)
+                        exposed[c.side] = true;
+                });
+                
+                for(uint8_t side = 0; side < 6; ++side) {
+                    if(!exposed[side])
+                        continue;
+                    
+                    boundary_face face = { e, voxel::face(side), {{ }} };
+                    for(size_t i = 0; i < 4; ++i)
+                        face.nodes[i] =
+                            _connectivity[e * 8 + face_nodes[side][i]];
+                    found[t].push_back(face);
+                }
+            }
+        });
+        
+        for(auto const&f : found)
+            _boundary.insert(_boundary.end(), f.begin(), f.end());
+    }
+    
+    /*
+     * A hanging node found on an edge or a face of an element of the given
+     * size, with the nodes of the edge or the face it depends on.
+     */
+    struct hanging_node {
+        uint64_t node;
+        uint32_t size;
+        uint8_t count;
+        std::array<uint64_t, 4> masters;
+        std::array<double, 4> weights;
+    };
+    
+    /*
+     * Hanging nodes are looked for on each element. Nodes strictly inside
+     * its edges are found in the sorted lines of nodes. Nodes strictly
+     * inside its faces must be corners of smaller leaves across the face,
+     * so they're found among the contacts.
+     *
+     * A node can hang on more than one element, and then the largest one
+     * wins, since the others are constrained by it in turn. For the same
+     * reason, masters may be hanging nodes of even larger elements, so
+     * constraints are resolved from the largest elements down.
+     */
+    void hex_mesh::find_constraints(octree const&oc,
+                                    std::vector<size_t> const&leaves,
+                                    std::vector<uint64_t> const&keys)
+    {
+        point_lines lines(keys);
+        
+        auto index = [&](glm::u32vec3 p) -> uint64_t {
+            uint64_t m = morton(p);
+            auto it = std::lower_bound(keys.begin(), keys.end(), m);
+            return it != keys.end() && *it == m ? uint64_t(it - keys.begin())
+                                                : uint64_t(-1);
+        };
+        
+        size_t tasks = (leaves.size() + chunk - 1) / chunk;
+        std::vector<std::vector<hanging_node>> found(tasks);
+        
+        parallel_for(tasks, [&](size_t t) {
+            std::vector<glm::u32vec3> points;
+            size_t last = std::min(leaves.size(), (t + 1) * chunk);
+            
+            for(size_t e = t * chunk; e < last; ++e) {
+                octree::const_iterator leaf = oc.begin() + ptrdiff_t(leaves[e]);
+                glm::u32vec3 origin(leaf->coordinates());
+                uint32_t size = leaf->size();
+                
+                auto corner = [&](uint8_t c) {
+                    return _connectivity[e * 8 + c];
+                };
+                
+                // Edges, as pairs of positions in the connectivity
+                static const uint8_t edges[12][2] = {
+                    { 0, 1 }, { 3, 2 }, { 4, 5 }, { 7, 6 },
+                    { 0, 3 }, { 1, 2 }, { 4, 7 }, { 5, 6 },
+                    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+                };
+                
+                for(auto const&edge : edges) {
+                    glm::u32vec3 a = unmorton(keys[corner(edge[0])]);
+                    glm::u32vec3 b = unmorton(keys[corner(edge[1])]);
+                    size_t axis = a.x != b.x ? 0 : a.y != b.y ? 1 : 2;
+                    
+                    points.clear();
+                    lines.between(a, b, points);
+                    
+                    for(glm::u32vec3 p : points) {
+                        double f = double(p[axis] - a[axis]) / size;
+                        
+                        found[t].push_back({ index(p), size, 2,
+                            {{ corner(edge[0]), corner(edge[1]), 0, 0 }},
+                            {{ 1 - f, f, 0, 0 }} });
+                    }
+                }
+                
+                for_each_contact(oc, leaf, [&](face_contact const&c) {
+                    if(c.size >= size)
+                        return;
+                    
+                    uint8_t axis = c.side / 2;
+                    uint8_t u = (axis + 1) % 3, v = (axis + 2) % 3;
+                    
+                    for(uint32_t i = 0; i < 4; ++i) {
+                        glm::u32vec3 p = c.origin;
+                        p[u] += (i & 1) * c.size;
+                        p[v] += (i >> 1) * c.size;
+                        
+                        if(p[u] <= origin[u] || p[u] >= origin[u] + size ||
+                           p[v] <= origin[v] || p[v] >= origin[v] + size)
+                            continue;
+                        
+                        uint64_t node = index(p);
+                        if(node == uint64_t(-1))
+                            continue;
+                        
+                        double fu = double(p[u] - origin[u]) / size;
+                        double fv = double(p[v] - origin[v]) / size;
+                        
+                        // Corners of the face: origin, +u, +u+v, +v
+                        glm::u32vec3 q[4] = { origin, origin, origin, origin };
+                        q[0][axis] = q[1][axis] = q[2][axis] = q[3][axis] =
+                            p[axis];
+                        q[1][u] += size;
+                        q[2][u] += size;
+                        q[2][v] += size;
+                        q[3][v] += size;
+                        
+                        found[t].push_back({ node, size, 4,
+                            {{ index(q[0]), index(q[1]),
+                               index(q[2]), index(q[3]) }},
+                            {{ (1 - fu) * (1 - fv), fu * (1 - fv),
+                               fu * fv, (1 - fu) * fv }} });
+                    }
+                });
+            }
+        });
+        
+        std::vector<hanging_node> hanging;
+        for(auto const&f : found)
+            hanging.insert(hanging.end(), f.begin(), f.end());
+        found.clear();
+        
+        // One constraint per node, from the largest element
+        std::sort(hanging.begin(), hanging.end(),
+                  [](hanging_node const&a, hanging_node const&b) {
+            return a.node < b.node || (a.node == b.node && a.size > b.size);
+        });
+        hanging.erase(std::unique(hanging.begin(), hanging.end(),
+                                  [](hanging_node const&a,
+                                     hanging_node const&b) {
+            return a.node == b.node;
+        }), hanging.end());
+        
+        // Resolution of the chains, from the largest elements down
+        std::vector<size_t> order(hanging.size());
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return hanging[a].size > hanging[b].size;
+        });
+        
+        using combination = std::vector<std::pair<uint64_t, double>>;
+        std::vector<combination> resolved(hanging.size());
+        
+        auto find = [&](uint64_t node) {
+            auto it = std::lower_bound(hanging.begin(), hanging.end(), node,
+                                       [](hanging_node const&h, uint64_t n) {
+                return h.node < n;
+            });
+            return it != hanging.end() && it->node == node
+                ? size_t(it - hanging.begin()) : size_t(-1);
+        };
+        
+        for(size_t i : order) {
+            hanging_node const&h = hanging[i];
+            combination &result = resolved[i];
+            
+            for(uint8_t k = 0; k < h.count; ++k) {
+                size_t j = find(h.masters[k]);
+                if(j == size_t(-1)) {
+                    result.push_back({ h.masters[k], h.weights[k] });
+                    continue;
+                }
+                
+                assert(hanging[j].size > h.size);
+                for(auto const&m : resolved[j])
+                    result.push_back({ m.first, m.second * h.weights[k] });
+            }
+            
+            std::sort(result.begin(), result.end());
+            combination merged;
+            for(auto const&m : result) {
+                if(!merged.empty() && merged.back().first == m.first)
+                    merged.back().second += m.second;
+                else
+                    merged.push_back(m);
+            }
+            result.swap(merged);
+        }
+        
+        _constraints = constraints_t();
+        _constraints.offsets.push_back(0);
+        for(size_t i = 0; i < hanging.size(); ++i) {
+            _constraints.nodes.push_back(hanging[i].node);
+            for(auto const&m : resolved[i]) {
+                _constraints.masters.push_back(m.first);
+                _constraints.weights.push_back(m.second);
+            }
+            _constraints.offsets.push_back(_constraints.masters.size());
+        }
+    }
+    
+    /*
+     * Every element couples all the nodes it depends on, i.e. its own
+     * nodes with the hanging ones replaced by their masters. Each row and
+     * column pair is packed in a single word, sorted and deduplicated,
+     * first in each parallel task and then globally.
+     */
+    void hex_mesh::find_adjacency()
+    {
+        assert(nodes() <= (uint64_t(1) << 32) &&
+               "Too many nodes for the adjacency computation");
+        
+        constraints_t const&c = _constraints;
+        
+        auto hanging = [&](uint64_t node) {
+            auto it = std::lower_bound(c.nodes.begin(), c.nodes.end(), node);
+            return it != c.nodes.end() && *it == node
+                ? size_t(it - c.nodes.begin()) : size_t(-1);
+        };
+        
+        size_t tasks = (elements() + chunk - 1) / chunk;
+        std::vector<std::vector<uint64_t>> found(tasks);
+        
+        parallel_for(tasks, [&](size_t t) {
+            std::vector<uint64_t> &pairs = found[t];
+            std::vector<uint64_t> dofs;
+            size_t last = std::min(elements(), (t + 1) * chunk);
+            
+            for(size_t e = t * chunk; e < last; ++e) {
+                dofs.clear();
+                for(size_t k = 0; k < 8; ++k) {
+                    uint64_t node = _connectivity[e * 8 + k];
+                    size_t h = hanging(node);
+                    if(h == size_t(-1))
+                        dofs.push_back(node);
+                    else
+                        dofs.insert(dofs.end(),
+                                    c.masters.begin() + ptrdiff_t(c.offsets[h]),
+                                    c.masters.begin() +
+                                        ptrdiff_t(c.offsets[h + 1]));
+                }
+                
+                std::sort(dofs.begin(), dofs.end());
+                dofs.erase(std::unique(dofs.begin(), dofs.end()), dofs.end());
+                
+                for(uint64_t i : dofs)
+                    for(uint64_t j : dofs)
+                        pairs.push_back(i << 32 | j);
+            }
+            
+            std::sort(pairs.begin(), pairs.end());
+            pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        });
+        
+        std::vector<uint64_t> pairs;
+        for(uint64_t h : c.nodes)
+            pairs.push_back(h << 32 | h);
+        for(auto &f : found) {
+            pairs.insert(pairs.end(), f.begin(), f.end());
+            std::vector<uint64_t>().swap(f);
+        }
+        
+        parallel_sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        
+        _adjacency.offsets.assign(nodes() + 1, 0);
+        _adjacency.columns.resize(pairs.size());
+        for(size_t k = 0; k < pairs.size(); ++k) {
+            ++_adjacency.offsets[(pairs[k] >> 32) + 1];
+            _adjacency.columns[k] = pairs[k] & 0xFFFFFFFF;
+        }
+        for(size_t i = 0; i < nodes(); ++i)
+            _adjacency.offsets[i + 1] += _adjacency.offsets[i];
+    }
+    
+    template<typename T>
+    static void put(std::ostream &out, std::vector<T> const&values) {
+        out.write(reinterpret_cast<char const *>(values.data()),
+                  std::streamsize(values.size() * sizeof(T)));
+    }
+    
+    static void put(std::ostream &out, uint64_t value) {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+    
+    bool hex_mesh::write_adjacency(std::ostream &out) const
+    {
+        put(out, uint64_t(_adjacency.offsets.empty()
+                          ? 0 : _adjacency.offsets.size() - 1));
+        put(out, uint64_t(_adjacency.columns.size()));
+        put(out, _adjacency.offsets);
+        put(out, _adjacency.columns);
+        
+        put(out, uint64_t(_constraints.nodes.size()));
+        put(out, _constraints.nodes);
+        put(out, _constraints.offsets);
+        put(out, _constraints.masters);
+        put(out, _constraints.weights);
+        
+        return bool(out);
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hexahedra.h"
+
+#include <algorithm>
+
+namespace ocmesh {
+namespace details {
+    
+    // Leaves processed by each parallel task
+    static const size_t chunk = 1 << 14;
+    
+    /*
+     * The corners of all the leaves are encoded and sorted, duplicates are
+     * removed, and each corner is then looked up in the resulting array.
+     */
+    hexahedra make_hexahedra(voxel const *leaves, size_t count,
+                             unsigned threads)
+    {
+        hexahedra result;
+        result.connectivity.resize(count * 8);
+        
+        size_t tasks = (count + chunk - 1) / chunk;
+        
+        parallel_for(tasks, [&](size_t t) {
+            size_t last = std::min(count, (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i) {
+                auto corners = leaves[i].corners<glm::u32vec3>();
+                for(size_t c = 0; c < 8; ++c)
+                    result.connectivity[i * 8 + c] =
+                        morton(corners[hex_nodes[c]]);
+            }
+        }, threads);
+        
+        result.nodes = result.connectivity;
+        parallel_sort(result.nodes.begin(), result.nodes.end(), threads);
+        result.nodes.erase(std::unique(result.nodes.begin(),
+                                       result.nodes.end()),
+                           result.nodes.end());
+        
+        parallel_for(tasks, [&](size_t t) {
+            auto first = result.connectivity.begin() + ptrdiff_t(t * chunk * 8);
+            auto last = result.connectivity.begin() +
+                        ptrdiff_t(std::min(count, (t + 1) * chunk) * 8);
+            
+            for(auto it = first; it != last; ++it)
+                *it = uint64_t(std::lower_bound(result.nodes.begin(),
+                                                result.nodes.end(), *it) -
+                               result.nodes.begin());
+        }, threads);
+        
+        return result;
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "pipeline.h"
+#include "hexahedra.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace ocmesh {
+namespace details {
+    
+    // Gmsh element type of the 8-node hexahedron
+    static const int msh_hexahedron = 5;
+    
+    // Items formatted by each parallel task
+    static const size_t chunk = 1 << 14;
+    
+    template<typename T>
+    static void put(std::ostream &out, T value) {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+    
+    template<typename T>
+    static void put(std::ostream &out, std::vector<T> const&values,
+                    size_t first = 0,
+                    size_t count = std::numeric_limits<size_t>::max())
+    {
+        count = std::min(count, values.size() - first);
+        out.write(reinterpret_cast<char const *>(values.data() + first),
+                  std::streamsize(count * sizeof(T)));
+    }
+    
+    /*
+     * Gmsh MSH 4.1 binary exporter.
+     *
+     * Every material becomes a volume entity with its own physical group,
+     * whose tag is the material itself, and its elements are written in a
+     * separate block. Nodes are the merged corners of the leaves, written
+     * in a single block. Node and element records have fixed size, so both
+     * are formatted in parallel straight into the output arrays.
+     *
+     * Gmsh needs the whole set of nodes before the elements, so the leaves
+     * given to the writer are kept until finish().
+     */
+    class msh_writer : public mesh_writer
+    {
+        struct entity {
+            voxel::material_t material;
+            size_t first;  // Range of the elements of the entity,
+            size_t last;   // in the sorted order
+            glm::u32vec3 min, max;
+        };
+        
+    public:
+        explicit msh_writer(std::ostream &out) : _out(out) { }
+        
+        void write(voxel const *leaves, size_t count) override
+        {
+            for(size_t i = 0; i < count; ++i) {
+                assert(leaves[i].material() != voxel::unknown_material);
+                if(leaves[i].material() != voxel::void_material)
+                    _leaves.push_back(leaves[i]);
+            }
+        }
+        
+        void finish() override
+        {
+            hexahedra hexes = make_hexahedra(_leaves.data(), _leaves.size());
+            
+            // Elements grouped by material, in Morton order in each group
+            std::vector<size_t> order(_leaves.size());
+            std::iota(order.begin(), order.end(), size_t(0));
+            parallel_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                voxel::material_t ma = _leaves[a].material(),
+                                  mb = _leaves[b].material();
+                return ma < mb || (ma == mb && a < b);
+            });
+            
+            std::vector<entity> entities = make_entities(order);
+            
+            _out << "$MeshFormat\n"
+                 << "4.1 1 " << sizeof(size_t) << "\n";
+            put(_out, int(1));
+            _out << "\n$EndMeshFormat\n";
+            
+            _out << "$PhysicalNames\n"
+                 << entities.size() << "\n";
+            for(entity const&e : entities)
+                _out << "3 " << e.material
+                     << " \"material_" << e.material << "\"\n";
+            _out << "$EndPhysicalNames\n";
+            
+            write_entities(entities);
+            write_nodes(hexes);
+            write_elements(hexes, entities, order);
+            
+            _out.flush();
+        }
+        
+    private:
+        std::vector<entity> make_entities(std::vector<size_t> const&order)
+        {
+            std::vector<entity> entities;
+            for(size_t i = 0; i < order.size(); ++i) {
+                voxel::material_t m = _leaves[order[i]].material();
+                if(entities.empty() || entities.back().material != m)
+                    entities.push_back({ m, i, i, {}, {} });
+                entities.back().last = i + 1;
+            }
+            
+            parallel_for(entities.size(), [&](size_t i) {
+                entity &e = entities[i];
+                
+                e.min = glm::u32vec3(std::numeric_limits<uint32_t>::max());
+                e.max = glm::u32vec3(0);
+                for(size_t j = e.first; j < e.last; ++j) {
+                    voxel v = _leaves[order[j]];
+                    auto corners = v.corners<glm::u32vec3>();
+                    e.min = glm::min(e.min, corners.front());
+                    e.max = glm::max(e.max, corners.back());
+                }
+            });
+            
+            return entities;
+        }
+        
+        void write_entities(std::vector<entity> const&entities)
+        {
+            _out << "$Entities\n";
+            
+            put(_out, size_t(0)); // Points
+            put(_out, size_t(0)); // Curves
+            put(_out, size_t(0)); // Surfaces
+            put(_out, entities.size());
+            
+            for(size_t i = 0; i < entities.size(); ++i) {
+                entity const&e = entities[i];
+                
+                put(_out, int(i + 1));
+                for(auto corner : { e.min, e.max })
+                    for(int c = 0; c < 3; ++c)
+                        put(_out, double(corner[c]));
+                
+                put(_out, size_t(1));
+                put(_out, int(e.material));
+                put(_out, size_t(0)); // Bounding surfaces
+            }
+            
+            _out << "\n$EndEntities\n";
+        }
+        
+        void write_nodes(hexahedra const&hexes)
+        {
+            size_t count = hexes.nodes.size();
+            
+            std::vector<size_t> tags(count);
+            std::vector<double> coordinates(count * 3);
+            
+            parallel_for((count + chunk - 1) / chunk, [&](size_t t) {
+                size_t last = std::min(count, (t + 1) * chunk);
+                for(size_t n = t * chunk; n < last; ++n) {
+                    glm::u32vec3 p = hexes.position(n);
+                    tags[n] = n + 1;
+                    coordinates[n * 3 + 0] = p.x;
+                    coordinates[n * 3 + 1] = p.y;
+                    coordinates[n * 3 + 2] = p.z;
+                }
+            });
+            
+            _out << "$Nodes\n";
+            
+            // Gmsh wants nodes classified on some entity: the first is fine
+            size_t blocks = count > 0 ? 1 : 0;
+            put(_out, blocks);
+            put(_out, count);
+            put(_out, size_t(1));
+            put(_out, count);
+            
+            if(blocks > 0) {
+                put(_out, int(3));
+                put(_out, int(1));
+                put(_out, int(0)); // No parametric coordinates
+                put(_out, count);
+                put(_out, tags);
+                put(_out, coordinates);
+            }
+            
+            _out << "\n$EndNodes\n";
+        }
+        
+        void write_elements(hexahedra const&hexes,
+                            std::vector<entity> const&entities,
+                            std::vector<size_t> const&order)
+        {
+            size_t count = order.size();
+            
+            // Element tag followed by the node tags
+            std::vector<size_t> records(count * 9);
+            
+            parallel_for((count + chunk - 1) / chunk, [&](size_t t) {
+                size_t last = std::min(count, (t + 1) * chunk);
+                for(size_t i = t * chunk; i < last; ++i) {
+                    size_t *record = &records[i * 9];
+                    record[0] = i + 1;
+                    for(size_t c = 0; c < 8; ++c)
+                        record[c + 1] =
+                            hexes.connectivity[order[i] * 8 + c] + 1;
+                }
+            });
+            
+            _out << "$Elements\n";
+            
+            put(_out, entities.size());
+            put(_out, count);
+            put(_out, size_t(1));
+            put(_out, count);
+            
+            for(size_t i = 0; i < entities.size(); ++i) {
+                entity const&e = entities[i];
+                
+                put(_out, int(3));
+                put(_out, int(i + 1));
+                put(_out, msh_hexahedron);
+                put(_out, e.last - e.first);
+                put(_out, records, e.first * 9, (e.last - e.first) * 9);
+            }
+            
+            _out << "\n$EndElements\n";
+        }
+        
+        std::ostream &_out;
+        std::vector<voxel> _leaves;
+    };
+    
+    std::unique_ptr<mesh_writer> make_msh_writer(std::ostream &out) {
+        return std14::make_unique<msh_writer>(out);
+    }
+    
+} // namespace details
+} // namespace ocmesh
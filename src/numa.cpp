@@ -0,0 +1,136 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "numa.h"
+#include "parallel.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Parses a sysfs list of CPUs or nodes like "0-3,8-11"
+     */
+    static std::vector<unsigned> parse_cpulist(std::string const&list)
+    {
+        std::vector<unsigned> cpus;
+        std::istringstream in(list);
+        std::string range;
+        
+        while(std::getline(in, range, ',')) {
+            unsigned first = 0, last = 0;
+            char dash = 0;
+            std::istringstream r(range);
+            
+            if(!(r >> first))
+                continue;
+            last = first;
+            if(r >> dash >> last && dash != '-')
+                last = first;
+            
+            for(unsigned cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        
+        return cpus;
+    }
+    
+    numa_topology::numa_topology()
+    {
+#ifdef __linux__
+        /*
+         * Node ids can have holes, e.g. after hot-removal or on some
+         * multi-socket machines, so they're read from the list of online
+         * nodes and numbered densely. Nodes without CPUs, like the ones of
+         * memory-only devices, can't run workers and are left out.
+         */
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        if(online && std::getline(online, nodes)) {
+            for(unsigned id : parse_cpulist(nodes)) {
+                std::ifstream file("/sys/devices/system/node/node" +
+                                   std::to_string(id) + "/cpulist");
+                std::string list;
+                if(!file || !std::getline(file, list))
+                    continue;
+                
+                std::vector<unsigned> cpus = parse_cpulist(list);
+                if(!cpus.empty())
+                    _cpus.push_back(std::move(cpus));
+            }
+        }
+#endif
+        
+        if(_cpus.empty()) {
+            _cpus.emplace_back();
+            for(unsigned cpu = 0; cpu < concurrency(); ++cpu)
+                _cpus.back().push_back(cpu);
+        }
+        
+        for(size_t node = 0; node < _cpus.size(); ++node) {
+            for(unsigned cpu : _cpus[node]) {
+                if(cpu >= _node_of_cpu.size())
+                    _node_of_cpu.resize(cpu + 1, 0);
+                _node_of_cpu[cpu] = node;
+            }
+        }
+    }
+    
+    numa_topology const&numa_topology::current() {
+        static numa_topology topology;
+        return topology;
+    }
+    
+    size_t numa_topology::current_node() const
+    {
+#ifdef __linux__
+        int cpu = sched_getcpu();
+        if(cpu >= 0 && size_t(cpu) < _node_of_cpu.size())
+            return _node_of_cpu[size_t(cpu)];
+#endif
+        return 0;
+    }
+    
+    bool numa_topology::pin(size_t worker) const
+    {
+#ifdef __linux__
+        std::vector<unsigned> const&node = _cpus[worker % _cpus.size()];
+        if(node.empty())
+            return false;
+        
+        unsigned cpu = node[(worker / _cpus.size()) % node.size()];
+        
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+        (void)worker;
+        return false;
+#endif
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -15,9 +15,9 @@
  */
 
 #include "octree.h"
+#include "pipeline.h"
 #include "glm.h"
 
-#include <vector>
 #include <tuple>
 #include <iterator>
 
@@ -113,62 +113,75 @@ namespace details {
     constexpr auto normals = make_normals();
     constexpr auto faces   = make_faces();
     
-    class obj
+    /*
+     * OBJ exporter, used both for whole octrees and by the pipeline.
+     * Since leaves may arrive one chunk at a time, nothing is buffered: the
+     * vertices and the faces of each cube are written together, and faces
+     * refer to the vertices of their cube with a running counter. Normals
+     * are written upfront, since they're the same for every cube.
+     */
+    class obj_writer : public mesh_writer
     {
     public:
-        void cube(voxel v) {
-            auto c = v.corners<glm::vec3>();
-            
-            _indexes.push_back(_vertices.size());
-            
-            _vertices.insert(_vertices.end(), begin(c), end(c));
-        }
-        
-        void write(std::ostream &os) const {
-            for(auto v : _vertices) {
-                os << "v " << v.x << " " << v.y << " " << v.z << "\n";
-            }
-            
-            os << "\n";
-            
+        explicit obj_writer(std::ostream &out) : _out(out)
+        {
             for(auto n : normals) {
-                os << "vn " << n[0] << " " << n[1] << " " << n[2] << "\n";
+                _out << "vn " << n[0] << " " << n[1] << " " << n[2] << "\n";
             }
-            
-            for (size_t i : _indexes) {
+        }
+        
+        void write(voxel const *leaves, size_t count) override
+        {
+            for(size_t l = 0; l < count; ++l) {
+                voxel v = leaves[l];
+                
+                assert(v.material() != voxel::unknown_material);
+                if(v.material() == voxel::void_material)
+                    continue;
+                
+                for(auto c : v.corners<glm::vec3>())
+                    _out << "v " << c.x << " " << c.y << " " << c.z << "\n";
+                
                 for(face f : faces) {
-                    for(size_t v = 0; v < f.vertices.size(); ++v) {
-                        if(v % 3 == 0)
-                            os << "\nf ";
-                        os << (f.vertices[v] + i + 1) << "//"
-                           << (f.normal + 1) << " ";
+                    for(size_t i = 0; i < f.vertices.size(); ++i) {
+                        _out << (i % 3 == 0 ? "f " : " ")
+                             << (f.vertices[i] + _vertices + 1) << "//"
+                             << (f.normal + 1)
+                             << (i % 3 == 2 ? "\n" : "");
                     }
                 }
+                
+                _vertices += 8;
             }
         }
         
+        void finish() override {
+            _out.flush();
+        }
+        
     private:
-        std::vector<glm::vec3> _vertices;
-        std::vector<size_t> _indexes;
+        std::ostream &_out;
+        size_t _vertices = 0;
     };
     
-    void obj_mesh(octree const&oc, std::ostream &out)
-    {
-        obj o;
-        for(voxel v : oc) {
-            assert(v.material() != voxel::unknown_material);
-            if(v.material() != voxel::void_material)
-                o.cube(v);
-        }
-        
-        o.write(out);
+    std::unique_ptr<mesh_writer> make_obj_writer(std::ostream &out) {
+        return std14::make_unique<obj_writer>(out);
     }
     
     void octree::mesh(mesh_t mesh_type, std::ostream &out) const {
         switch (mesh_type) {
-            case obj:
-                obj_mesh(*this, out);
+            case obj: {
+                auto writer = make_obj_writer(out);
+                writer->write(_data.data(), _data.size());
+                writer->finish();
+                return;
+            }
+            case msh: {
+                auto writer = make_msh_writer(out);
+                writer->write(_data.data(), _data.size());
+                writer->finish();
                 return;
+            }
         }
         assert(!"Unimplemented mesh type");
     }
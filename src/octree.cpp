@@ -15,51 +15,178 @@
  */
 
 #include "octree.h"
+#include "parallel.h"
+#include "scene_builder.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace ocmesh {
 namespace details {
     
+    void octree::sparsify()
+    {
+        _storage = sparse;
+        
+        for(leaf_attribute &attribute : _attributes)
+            attribute.compact([&](size_t leaf) {
+                return _data[leaf].material() != voxel::void_material;
+            });
+        
+        _data.erase(drop_void(_data.begin(), _data.end()), _data.end());
+    }
+    
+    leaf_attribute const*octree::attribute(std::string const&name) const
+    {
+        for(leaf_attribute const&attribute : _attributes)
+            if(attribute.name() == name)
+                return &attribute;
+        
+        return nullptr;
+    }
+    
+    void octree::set_attribute(leaf_attribute attribute)
+    {
+        assert(attribute.size() == size() && "Attribute size mismatch");
+        
+        for(leaf_attribute &a : _attributes)
+            if(a.name() == attribute.name()) {
+                a = std::move(attribute);
+                return;
+            }
+        
+        _attributes.push_back(std::move(attribute));
+    }
+    
+    /*
+     * The leaf containing a point is the last one whose Morton code is not
+     * greater than the Morton code of the point, provided that it actually
+     * extends up to the point. In a dense octree it always does.
+     */
+    template<typename It>
+    static It locate_in(It first, It last, It end, uint64_t m)
+    {
+        voxel key(m, voxel::max_level, voxel::max_material);
+        
+        It it = std::upper_bound(first, last, key);
+        if(it == first)
+            return end;
+        
+        --it;
+        uint64_t span = uint64_t(1) << (3 * it->height());
+        
+        return m < it->morton() + span ? it : end;
+    }
+    
+    octree::const_iterator octree::locate(glm::u16vec3 point) const
+    {
+        uint64_t m = morton(glm::u32vec3(point));
+        
+        return locate_in(begin(), end(), end(), m);
+    }
+    
+    void octree::locate(glm::u16vec3 const *points, size_t count,
+                        const_iterator *result) const
+    {
+        std::vector<std::pair<uint64_t, size_t>> queries(count);
+        for(size_t i = 0; i < count; ++i)
+            queries[i] = { morton(glm::u32vec3(points[i])), i };
+        
+        std::sort(queries.begin(), queries.end());
+        
+        // Each search starts where the previous one ended
+        const_iterator first = begin();
+        for(auto q : queries) {
+            const_iterator it = locate_in(first, end(), end(), q.first);
+            result[q.second] = it;
+            
+            if(it != end())
+                first = it;
+        }
+    }
+    
+    voxel::material_t octree::material_at(glm::u16vec3 point) const
+    {
+        const_iterator it = locate(point);
+        
+        return it != end() ? it->material() : voxel::void_material;
+    }
+    
+    /*
+     * voxel::neighbor() returns a voxel of the finest level, located in the
+     * cell adjacent to the given face, or a voxel of level 0 if there's
+     * no neighbor at all.
+     */
+    static bool has_neighbor(voxel candidate) {
+        return candidate.level() == voxel::max_level;
+    }
+    
     octree::iterator
     octree::neighbor(const_iterator node, voxel::face f)
     {
-        voxel candidate = node->neighbor(f);
+        const_iterator it = static_cast<octree const&>(*this).neighbor(node, f);
         
-        return std::lower_bound(begin(), end(), candidate);
+        return begin() + (it - cbegin());
     }
     
     octree::const_iterator
     octree::neighbor(const_iterator node, voxel::face f) const
     {
         voxel candidate = node->neighbor(f);
+        if(!has_neighbor(candidate))
+            return end();
         
-        return std::lower_bound(begin(), end(), candidate);
+        return locate(candidate.coordinates());
     }
     
     octree::iterator
     octree::neighbor(const_iterator node, voxel::face f1, voxel::face f2)
     {
-        voxel candidate = node->neighbor(f1).neighbor(f2);
+        const_iterator it =
+            static_cast<octree const&>(*this).neighbor(node, f1, f2);
         
-        return std::lower_bound(begin(), end(), candidate);
+        return begin() + (it - cbegin());
     }
     
+    /*
+     * For edge neighbors, the second step has to be as large as the node,
+     * so we restore the level of the node before taking it.
+     */
     octree::const_iterator
     octree::neighbor(const_iterator node, voxel::face f1, voxel::face f2) const
     {
-        voxel candidate = node->neighbor(f1).neighbor(f2);
+        voxel first = node->neighbor(f1);
+        if(!has_neighbor(first))
+            return end();
         
-        return std::lower_bound(begin(), end(), candidate);
+        voxel candidate = first.with_level(node->level()).neighbor(f2);
+        if(!has_neighbor(candidate))
+            return end();
+        
+        return locate(candidate.coordinates());
     }
     
-    // TODO: handle the case when the subdivision reaches the final level
-    //       but the split function still has not decided the material
-    void octree::build(std::function<voxel::material_t(voxel)> split_function)
+    void octree::build(split_function_t split_function)
     {
+        _data.clear();
         _data.push_back(voxel{});
+        _attributes.clear();
+        
+        subdivide(split_function, 0);
+        
+        _data.erase(drop_void(_data.begin(), _data.end()), _data.end());
+        std::sort(_data.begin(), _data.end());
         
-        for(size_t i = 0; i < _data.size(); ++i)
+        _stats = build_stats();
+        _stats.leaves = _data.size();
+        _stats.tasks = 1;
+    }
+    
+    // TODO: handle the case when the subdivision reaches the final level
+    //       but the split function still has not decided the material
+    void octree::subdivide(split_function_t const&split_function, size_t from)
+    {
+        for(size_t i = from; i < _data.size(); ++i)
         {
             voxel v = _data[i];
             uint8_t level = v.level();
@@ -78,80 +205,116 @@ namespace details {
             }
         }
 
-        assert(std::none_of(_data.begin(), _data.end(), [](voxel v) {
+        assert(std::none_of(_data.begin() + from, _data.end(), [](voxel v) {
             return v.material() == voxel::unknown_material;
         }));
-        
-        std::sort(_data.begin(), _data.end());
     }
     
-    
     /*
-     * Function object for the subdivision of the octree from the CSG scene.
+     * Breadth-first expansion of the top levels of the tree, used by the
+     * parallel builds to find independent subtrees. Voxels that get a
+     * material before the given depth are final leaves, while the ones
+     * still undecided at that depth are returned as open subtrees.
+     * Both sequences are returned sorted.
      */
-    class scene_builder
+    void octree::expand(split_function_t const&split_function, uint8_t depth,
+                        std::vector<voxel> &leaves,
+                        std::vector<voxel> &open) const
     {
-    public:
-        scene_builder(csg::scene const&scene, float precision)
-            : _scene(scene), _bounding_box(_scene.bounding_box()),
-              _precision(precision) { }
-        
+        std::vector<voxel> frontier = { voxel{} };
         
-        voxel::material_t operator()(voxel v) const {
-            for(auto *obj : _scene) {
-                intersection_result r = intersection(obj, v);
-                if(r == inside)
-                    return obj->material();
-                if(r == at_intersection)
-                    return voxel::unknown_material;
-            }
+        while(!frontier.empty()) {
+            std::vector<voxel> next;
             
-            return voxel::void_material;
-        }
-        
-    private:
-        enum intersection_result {
-            inside,
-            outside,
-            at_intersection
-        };
-        
-        /*
-         * The core function of the subdivision procedure is here. It decides
-         * if a voxel intersects a given CSG object or not.
-         */
-        intersection_result intersection(csg::object *obj, voxel v) const
-        {
-            glm::vec3 coordinates = glm::vec3(v.coordinates());
-            float side = v.size();
-            
-            // Scale the voxel to the scene bounding box
-            float scale = _bounding_box.side() / voxel::max_coordinate;
-            coordinates = coordinates * scale + _bounding_box.min();
-            side *= scale;
-            
-            glm::vec3 center = coordinates + glm::vec3{ side / 2, side / 2, side / 2 };
-            float diagonal = std::sqrt(3) * side;
-            
-            float d = obj->distance(center);
-            if(std::abs(d) < diagonal / 2 &&
-               side >= _bounding_box.side() * _precision)
-            {
-                return at_intersection;
+            for(voxel v : frontier) {
+                if(v.level() == depth) {
+                    open.push_back(v);
+                    continue;
+                }
+                
+                voxel::material_t material = split_function(v);
+                
+                if(v.level() < voxel::max_level &&
+                   material == voxel::unknown_material)
+                {
+                    auto children = v.children();
+                    next.insert(next.end(), children.begin(), children.end());
+                } else {
+                    leaves.push_back(v.with_material(material));
+                }
             }
             
-            return d > 0 ? outside : inside;
+            frontier.swap(next);
         }
         
-    private:
-        csg::scene const&_scene;
-        csg::bounding_box _bounding_box;
-        float _precision;
-    };
+        std::sort(leaves.begin(), leaves.end());
+        std::sort(open.begin(), open.end());
+    }
     
     void octree::build(csg::scene const&scene, float precision) {
         build(scene_builder(scene, precision));
     }
     
+    void octree::build(csg::scene const&scene, float precision,
+                       build_options const&options)
+    {
+        build(scene_builder(scene, precision), options);
+    }
+    
+    void octree::build_batched(csg::scene const&scene, float precision,
+                               unsigned threads)
+    {
+        build_batched(scene_builder(scene, precision), threads);
+    }
+    
+    void octree::build_batched(csg::scene const&scene, float precision,
+                               distance_options const&options,
+                               unsigned threads)
+    {
+        if(threads == 0)
+            threads = concurrency();
+        
+        scene_builder builder(scene, precision);
+        std::vector<float> centers;
+        
+        build_levels(builder, threads, options.centers ? &centers : nullptr);
+        
+        leaf_attribute::format_t format = options.half ?
+            leaf_attribute::float16 : leaf_attribute::float32;
+        
+        if(options.centers) {
+            leaf_attribute attribute("center_distance", size(), 1, format);
+            for(size_t i = 0; i < size(); ++i)
+                attribute.set(i, centers[i]);
+            set_attribute(std::move(attribute));
+        }
+        
+        if(!options.corners)
+            return;
+        
+        leaf_attribute corners("corner_distances", size(), 8, format);
+        
+        static const size_t chunk = 1 << 12;
+        parallel_for((size() + chunk - 1) / chunk, [&](size_t t) {
+            size_t first = t * chunk;
+            size_t n = std::min(chunk, size() - first);
+            
+            std::vector<glm::vec3> points;
+            points.reserve(n * 8);
+            for(size_t i = first; i < first + n; ++i)
+                for(glm::vec3 p : _data[i].corners<glm::vec3>())
+                    points.push_back(p);
+            
+            std::vector<float> result(points.size());
+            builder.field(points.data(), points.size(), result.data());
+            
+            for(size_t i = 0; i < n; ++i)
+                for(unsigned c = 0; c < 8; ++c)
+                    corners.set(first + i, c, result[i * 8 + c]);
+        }, threads);
+        
+        set_attribute(std::move(corners));
+    }
+    
 } // namespace details
 } // namespace ocmesh
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "face_contacts.h"
+#include "hexahedra.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <cerrno>
+#include <sys/stat.h>
+
+namespace ocmesh {
+namespace details {
+    
+    // Leaves or list items processed by each parallel task
+    static const size_t chunk = 1 << 12;
+    
+    static const uint64_t no_cell = uint64_t(-1);
+    
+    /*
+     * A face of the mesh: a square orthogonal to the given axis, oriented
+     * so that its normal points out of the owner cell.
+     */
+    struct foam_face {
+        uint64_t owner;
+        uint64_t neighbour; // no_cell for boundary faces
+        voxel::material_t patch;
+        uint8_t axis;
+        bool positive;      // The normal points along the axis
+        glm::u32vec3 origin;
+        uint32_t size;
+        
+        std::array<glm::u32vec3, 4> corners() const {
+            glm::u32vec3 u(0), v(0);
+            u[(axis + 1) % 3] = size;
+            v[(axis + 2) % 3] = size;
+            
+            if(positive)
+                return {{ origin, origin + u, origin + u + v, origin + v }};
+            return {{ origin, origin + v, origin + u + v, origin + u }};
+        }
+    };
+    
+    /*
+     * Enumeration of the faces of the solid leaves.
+     *
+     * Every face is emitted by the smaller of the two cells it separates,
+     * as a face of that cell, so faces are automatically split where a
+     * cell touches smaller ones. Faces between cells of the same size are
+     * emitted by the cell on the negative side. Faces towards void leaves,
+     * missing ranges of a sparse octree, or the outside of the domain are
+     * boundary faces, emitted by the solid cell, with the size of the void
+     * region if that's smaller.
+     */
+    static void leaf_faces(octree const&oc, std::vector<uint64_t> const&cells,
+                           size_t leaf, std::vector<foam_face> &result)
+    {
+        octree::const_iterator it = oc.begin() + ptrdiff_t(leaf);
+        uint64_t a = cells[leaf];
+        
+        for_each_contact(oc, it, [&](face_contact const&c) {
+            uint8_t axis = c.side / 2;
+            bool positive = c.side % 2;
+            
+            if(c.neighbour == oc.end() ||
+               c.neighbour->material() == voxel::void_material)
+            {
+                result.push_back({ a, no_cell, it->material(),
+                                   axis, positive, c.origin, c.size });
+                return;
+            }
+            
+            // Smaller neighbours emit their own faces
+            if(c.neighbour->level() > it->level())
+                return;
+            
+            if(c.neighbour->level() == it->level() && !positive)
+                return;
+            
+            uint64_t b = cells[size_t(c.neighbour - oc.begin())];
+            
+            result.push_back({ std::min(a, b), std::max(a, b), 0,
+                               axis, a < b ? positive : !positive,
+                               c.origin, c.size });
+        });
+    }
+    
+    /*
+     * Formats a list in parallel, a batch of chunks at a time
+     */
+    template<typename F>
+    static void write_list(std::ostream &out, size_t count, F const&format)
+    {
+        out << count << "\n(\n";
+        
+        size_t tasks = (count + chunk - 1) / chunk;
+        size_t batch = concurrency() * 4;
+        
+        for(size_t first = 0; first < tasks; first += batch) {
+            size_t n = std::min(batch, tasks - first);
+            std::vector<std::string> text(n);
+            
+            parallel_for(n, [&](size_t t) {
+                std::ostringstream s;
+                size_t begin = (first + t) * chunk;
+                size_t end = std::min(count, begin + chunk);
+                for(size_t i = begin; i < end; ++i)
+                    format(s, i);
+                text[t] = s.str();
+            });
+            
+            for(std::string const&s : text)
+                out << s;
+        }
+        
+        out << ")\n";
+    }
+    
+    static void foam_header(std::ostream &out, char const *cls,
+                            char const *object, std::string const&note = "")
+    {
+        out << "FoamFile\n"
+            << "{\n"
+            << "    version     2.0;\n"
+            << "    format      ascii;\n"
+            << "    class       " << cls << ";\n";
+        if(!note.empty())
+            out << "    note        \"" << note << "\";\n";
+        out << "    location    \"constant/polyMesh\";\n"
+            << "    object      " << object << ";\n"
+            << "}\n\n";
+    }
+    
+    /*
+     * OpenFOAM polyMesh export.
+     *
+     * Cells are the solid leaves in Morton order. Faces are enumerated in
+     * parallel over the leaves, then internal faces are sorted by owner
+     * and neighbour, as the upper-triangular order of OpenFOAM requires,
+     * and boundary faces are grouped in one patch per material.
+     *
+     * Where a cell touches smaller ones, the points of the small faces lie
+     * on the edges of the faces of the big cell too, so they're inserted in
+     * its faces to keep the cells closed.
+     */
+    bool octree::mesh_openfoam(std::string const&directory) const
+    {
+        if(::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+        
+        // Cell index of each solid leaf
+        std::vector<uint64_t> cells(size(), no_cell);
+        uint64_t ncells = 0;
+        for(size_t i = 0; i < size(); ++i) {
+            voxel::material_t m = (begin() + ptrdiff_t(i))->material();
+            assert(m != voxel::unknown_material);
+            if(m != voxel::void_material)
+                cells[i] = ncells++;
+        }
+        
+        size_t tasks = (size() + chunk - 1) / chunk;
+        std::vector<std::vector<foam_face>> found(tasks);
+        parallel_for(tasks, [&](size_t t) {
+            size_t last = std::min(size(), (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i)
+                if(cells[i] != no_cell)
+                    leaf_faces(*this, cells, i, found[t]);
+        });
+        
+        std::vector<foam_face> faces;
+        for(auto const&f : found)
+            faces.insert(faces.end(), f.begin(), f.end());
+        found.clear();
+        
+        parallel_sort(faces.begin(), faces.end(),
+                      [](foam_face const&a, foam_face const&b) {
+            bool ba = a.neighbour == no_cell, bb = b.neighbour == no_cell;
+            if(ba != bb)
+                return bb;
+            if(ba)
+                return std::tie(a.patch, a.owner, a.axis, a.positive) <
+                       std::tie(b.patch, b.owner, b.axis, b.positive) ||
+                       (std::tie(a.patch, a.owner, a.axis, a.positive) ==
+                        std::tie(b.patch, b.owner, b.axis, b.positive) &&
+                        morton(a.origin) < morton(b.origin));
+            return std::tie(a.owner, a.neighbour) <
+                   std::tie(b.owner, b.neighbour);
+        });
+        
+        size_t internal = size_t(std::find_if(faces.begin(), faces.end(),
+                                              [](foam_face const&f) {
+            return f.neighbour == no_cell;
+        }) - faces.begin());
+        
+        // Points are the corners of the faces, merged
+        std::vector<uint64_t> points(faces.size() * 4);
+        parallel_for(tasks = (faces.size() + chunk - 1) / chunk,
+                     [&](size_t t) {
+            size_t last = std::min(faces.size(), (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i) {
+                auto corners = faces[i].corners();
+                for(size_t c = 0; c < 4; ++c)
+                    points[i * 4 + c] = morton(corners[c]);
+            }
+        });
+        parallel_sort(points.begin(), points.end());
+        points.erase(std::unique(points.begin(), points.end()), points.end());
+        
+        point_lines lines(points);
+        
+        auto index = [&](glm::u32vec3 p) {
+            return std::lower_bound(points.begin(), points.end(), morton(p)) -
+                   points.begin();
+        };
+        
+        std::ostringstream note;
+        note << "nPoints:" << points.size() << " nCells:" << ncells
+             << " nFaces:" << faces.size()
+             << " nInternalFaces:" << internal;
+        
+        std::ofstream out(directory + "/points");
+        foam_header(out, "vectorField", "points");
+        write_list(out, points.size(), [&](std::ostream &s, size_t i) {
+            glm::u32vec3 p = unmorton(points[i]);
+            s << "(" << p.x << " " << p.y << " " << p.z << ")\n";
+        });
+        bool ok = bool(out);
+        out.close();
+        
+        out.open(directory + "/faces");
+        foam_header(out, "faceList", "faces");
+        write_list(out, faces.size(), [&](std::ostream &s, size_t i) {
+            auto corners = faces[i].corners();
+            std::vector<glm::u32vec3> polygon;
+            for(size_t c = 0; c < 4; ++c) {
+                polygon.push_back(corners[c]);
+                lines.between(corners[c], corners[(c + 1) % 4], polygon);
+            }
+            
+            s << polygon.size() << "(";
+            for(size_t p = 0; p < polygon.size(); ++p)
+                s << (p ? " " : "") << index(polygon[p]);
+            s << ")\n";
+        });
+        ok = ok && out;
+        out.close();
+        
+        out.open(directory + "/owner");
+        foam_header(out, "labelList", "owner", note.str());
+        write_list(out, faces.size(), [&](std::ostream &s, size_t i) {
+            s << faces[i].owner << "\n";
+        });
+        ok = ok && out;
+        out.close();
+        
+        out.open(directory + "/neighbour");
+        foam_header(out, "labelList", "neighbour", note.str());
+        write_list(out, internal, [&](std::ostream &s, size_t i) {
+            s << faces[i].neighbour << "\n";
+        });
+        ok = ok && out;
+        out.close();
+        
+        std::vector<std::pair<voxel::material_t, size_t>> patches;
+        for(size_t i = internal; i < faces.size(); ++i)
+            if(patches.empty() || patches.back().first != faces[i].patch)
+                patches.push_back({ faces[i].patch, i });
+        
+        out.open(directory + "/boundary");
+        foam_header(out, "polyBoundaryMesh", "boundary");
+        out << patches.size() << "\n(\n";
+        for(size_t p = 0; p < patches.size(); ++p) {
+            size_t end = p + 1 < patches.size() ? patches[p + 1].second
+                                                : faces.size();
+            out << "    material_" << patches[p].first << "\n"
+                << "    {\n"
+                << "        type            patch;\n"
+                << "        nFaces          " << end - patches[p].second
+                << ";\n"
+                << "        startFace       " << patches[p].second << ";\n"
+                << "    }\n";
+        }
+        out << ")\n";
+        ok = ok && out;
+        
+        return ok;
+    }
+    
+} // namespace details
+} // namespace ocmesh
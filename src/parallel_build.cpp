@@ -0,0 +1,191 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "parallel.h"
+#include "numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * Runs f(worker) on the given number of new threads. The calling thread
+     * only waits, so that pinning a worker never changes its own affinity.
+     */
+    template<typename F>
+    static void run_workers(unsigned threads, F const&f)
+    {
+        std::vector<std::thread> pool;
+        for(unsigned w = 0; w < threads; ++w)
+            pool.emplace_back(f, w);
+        
+        for(std::thread &t : pool)
+            t.join();
+    }
+    
+    void octree::build(split_function_t split_function,
+                       build_options const&options)
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        numa_topology const&topology = numa_topology::current();
+        unsigned threads = options.threads ? options.threads : concurrency();
+        
+        // A few open subtrees for each worker, to balance the load
+        uint8_t depth = 0;
+        while(depth < voxel::max_level &&
+              (size_t(1) << (3 * depth)) < 8 * size_t(threads))
+            ++depth;
+        
+        std::vector<voxel> leaves;
+        std::vector<voxel> open;
+        expand(split_function, depth, leaves, open);
+        leaves.erase(drop_void(leaves.begin(), leaves.end()), leaves.end());
+        
+        /*
+         * First phase: subdivision of the open subtrees.
+         * Each worker appends the leaves of its subtrees to a private
+         * buffer, and remembers where the leaves of each subtree are.
+         */
+        struct task_result {
+            unsigned worker;
+            size_t offset;
+            size_t count;
+        };
+        
+        std::vector<task_result> results(open.size());
+        std::vector<container_t> buffers(threads);
+        std::atomic<size_t> next(0);
+        std::atomic<unsigned> pinned(0);
+        
+        run_workers(threads, [&](unsigned w) {
+            if(options.pin_threads && topology.pin(w))
+                ++pinned;
+            
+            octree local;
+            for(size_t i = next++; i < open.size(); i = next++) {
+                size_t from = local._data.size();
+                
+                local._data.push_back(open[i]);
+                local.subdivide(split_function, from);
+                std::sort(local._data.begin() + ptrdiff_t(from),
+                          local._data.end());
+                local._data.erase(drop_void(local._data.begin() + ptrdiff_t(from),
+                                            local._data.end()),
+                                  local._data.end());
+                
+                results[i] = { w, from, local._data.size() - from };
+            }
+            
+            buffers[w] = std::move(local._data);
+        });
+        
+        /*
+         * Final layout: coarse leaves and subtrees are interleaved in
+         * Morton order. The array is allocated without touching its pages.
+         */
+        std::vector<size_t> destination(open.size());
+        size_t total = 0;
+        
+        auto leaf = leaves.begin();
+        for(size_t i = 0; i < open.size(); ++i) {
+            auto bound = std::lower_bound(leaf, leaves.end(), open[i]);
+            total += size_t(bound - leaf);
+            leaf = bound;
+            
+            destination[i] = total;
+            total += results[i].count;
+        }
+        total += size_t(leaves.end() - leaf);
+        
+        _data = container_t(
+                    octree_allocator<voxel>::uninitialized(options.huge_pages));
+        _data.resize(total);
+        _data = container_t(std::move(_data),
+                            octree_allocator<voxel>(options.huge_pages));
+        _attributes.clear();
+        
+        /*
+         * Second phase: each worker copies its own leaves to their final
+         * position, so the pages of the final array are first touched on
+         * the node of the worker that produced them. The node of each
+         * worker is only known for sure if it's pinned, since otherwise it
+         * can migrate while copying.
+         */
+        std::vector<size_t> nodes(threads, 0);
+        std::atomic<unsigned> copy_pinned(0);
+        
+        run_workers(threads, [&](unsigned w) {
+            if(options.pin_threads && topology.pin(w))
+                ++copy_pinned;
+            nodes[w] = topology.current_node();
+            
+            for(size_t i = 0; i < open.size(); ++i) {
+                if(results[i].worker != w)
+                    continue;
+                
+                auto first = buffers[w].begin() + ptrdiff_t(results[i].offset);
+                std::copy(first, first + ptrdiff_t(results[i].count),
+                          _data.begin() + ptrdiff_t(destination[i]));
+            }
+            
+            container_t().swap(buffers[w]);
+        });
+        
+        // The coarse leaves fill the remaining holes
+        size_t position = 0;
+        leaf = leaves.begin();
+        for(size_t i = 0; i <= open.size(); ++i) {
+            auto bound = i < open.size()
+                       ? std::lower_bound(leaf, leaves.end(), open[i])
+                       : leaves.end();
+            
+            position = std::copy(leaf, bound,
+                                 _data.begin() + ptrdiff_t(position))
+                     - _data.begin();
+            leaf = bound;
+            
+            if(i < open.size())
+                position += results[i].count;
+        }
+        
+        /*
+         * Statistics
+         */
+        _stats = build_stats();
+        _stats.threads = threads;
+        _stats.pinned_threads = pinned;
+        _stats.huge_pages = !_data.empty() &&
+                    octree_allocator<voxel>::huge_page_bytes(_data.data()) > 0;
+        _stats.leaves = total;
+        _stats.tasks = open.size();
+        if(copy_pinned == threads) {
+            _stats.leaves_per_node.assign(topology.nodes(), 0);
+            for(task_result const&r : results)
+                _stats.leaves_per_node[nodes[r.worker]] += r.count;
+        }
+        
+        _stats.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pipeline.h"
+#include "bounded_queue.h"
+#include "scene_builder.h"
+
+#include <exception>
+#include <thread>
+
+namespace ocmesh {
+namespace details {
+    
+    // Leaves in a chunk, and chunks in flight between build and export
+    static const size_t chunk_size = 4096;
+    static const size_t queue_capacity = 16;
+    
+    mesh_writer::~mesh_writer() = default;
+    
+    std::unique_ptr<mesh_writer> mesh_writer::make(octree::mesh_t type,
+                                                   std::ostream &out)
+    {
+        switch(type) {
+            case octree::obj:
+                return make_obj_writer(out);
+            case octree::msh:
+                return make_msh_writer(out);
+        }
+        assert(!"Unimplemented mesh type");
+        return nullptr;
+    }
+    
+    void build_depth_first(octree::split_function_t const&split_function,
+                           size_t chunk,
+                           std::function<void(std::vector<voxel>)> const&emit)
+    {
+        std::vector<voxel> stack = { voxel{} };
+        std::vector<voxel> leaves;
+        leaves.reserve(chunk);
+        
+        while(!stack.empty()) {
+            voxel v = stack.back();
+            stack.pop_back();
+            
+            voxel::material_t material = split_function(v);
+            
+            if(v.level() < voxel::max_level &&
+               material == voxel::unknown_material)
+            {
+                // Pushed in reverse, so that the first child is visited first
+                auto children = v.children();
+                stack.insert(stack.end(), children.rbegin(), children.rend());
+                continue;
+            }
+            
+            leaves.push_back(v.with_material(material));
+            
+            if(leaves.size() == chunk) {
+                emit(std::move(leaves));
+                leaves.clear();
+                leaves.reserve(chunk);
+            }
+        }
+        
+        if(!leaves.empty())
+            emit(std::move(leaves));
+    }
+    
+    // Thrown through the build when the exporter gives up, to stop it
+    struct build_aborted { };
+    
+    void stream_mesh(octree::split_function_t split_function,
+                     octree::mesh_t type, std::ostream &out)
+    {
+        bounded_queue<std::vector<voxel>> queue(queue_capacity);
+        
+        // Exceptions of the build are handed over to the calling thread
+        std::exception_ptr failure;
+        
+        std::thread builder([&]() {
+            try {
+                build_depth_first(split_function, chunk_size,
+                                  [&](std::vector<voxel> leaves) {
+                    if(!queue.push(std::move(leaves)))
+                        throw build_aborted();
+                });
+            } catch(build_aborted const&) {
+            } catch(...) {
+                failure = std::current_exception();
+            }
+            queue.close();
+        });
+        
+        std::unique_ptr<mesh_writer> writer;
+        try {
+            writer = mesh_writer::make(type, out);
+            
+            std::vector<voxel> leaves;
+            while(queue.pop(leaves))
+                writer->write(leaves.data(), leaves.size());
+        } catch(...) {
+            queue.abort();
+            builder.join();
+            throw;
+        }
+        
+        builder.join();
+        
+        if(failure)
+            std::rethrow_exception(failure);
+        
+        writer->finish();
+    }
+    
+    void stream_mesh(csg::scene const&scene, float precision,
+                     octree::mesh_t type, std::ostream &out)
+    {
+        stream_mesh(scene_builder(scene, precision), type, out);
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ocmesh {
+namespace details {
+    
+    // Rays cast together by each parallel task
+    static const size_t packet = 256;
+    
+    static const float domain = float(uint32_t(1) << voxel::max_level);
+    
+    /*
+     * The largest Morton-aligned cube around a cell that's not covered by
+     * any leaf of a sparse octree. It spans from the end of the last leaf
+     * before the cell to the start of the first one after it.
+     */
+    static void empty_cube(octree const&oc, glm::u32vec3 cell,
+                           glm::u32vec3 &origin, uint32_t &size)
+    {
+        uint64_t m = morton(cell);
+        
+        auto next = std::lower_bound(oc.begin(), oc.end(), voxel(m, 0, 0));
+        
+        uint64_t first = 0;
+        if(next != oc.begin()) {
+            voxel prev = *(next - 1);
+            first = prev.morton() + (uint64_t(1) << (3 * prev.height()));
+        }
+        uint64_t last = next != oc.end() ? next->morton()
+                                         : uint64_t(1) << voxel::location_bits;
+        
+        uint8_t height = 0;
+        while(height < voxel::max_level) {
+            uint64_t span = uint64_t(1) << (3 * (height + 1));
+            uint64_t base = m & ~(span - 1);
+            if(base < first || base + span > last)
+                break;
+            ++height;
+        }
+        
+        uint64_t base = m & ~((uint64_t(1) << (3 * height)) - 1);
+        origin = unmorton(base);
+        size = uint32_t(1) << height;
+    }
+    
+    octree::ray_hit octree::raycast(glm::vec3 origin, glm::vec3 direction,
+                                    float max_distance) const
+    {
+        ray_hit result = { end(), voxel::void_material, max_distance };
+        
+        float length = glm::length(direction);
+        if(length == 0)
+            return result;
+        glm::vec3 d = direction / length;
+        
+        // Clipping of the ray against the domain
+        float t = 0, t_max = max_distance;
+        for(size_t a = 0; a < 3; ++a) {
+            if(d[a] == 0) {
+                if(origin[a] < 0 || origin[a] >= domain)
+                    return result;
+                continue;
+            }
+            float near = (0 - origin[a]) / d[a];
+            float far = (domain - origin[a]) / d[a];
+            t = std::max(t, std::min(near, far));
+            t_max = std::min(t_max, std::max(near, far));
+        }
+        if(t > t_max)
+            return result;
+        
+        glm::u32vec3 cell;
+        glm::vec3 p = origin + d * t;
+        for(size_t a = 0; a < 3; ++a)
+            cell[a] = uint32_t(std::min(std::max(std::floor(p[a]), 0.0f),
+                                        float(voxel::max_coordinate)));
+        
+        while(true) {
+            const_iterator it = locate(glm::u16vec3(cell));
+            
+            glm::u32vec3 lo;
+            uint32_t size;
+            if(it != end()) {
+                if(it->material() != voxel::void_material) {
+                    result.leaf = it;
+                    result.material = it->material();
+                    result.distance = t;
+                    return result;
+                }
+                lo = glm::u32vec3(it->coordinates());
+                size = it->size();
+            } else
+                empty_cube(*this, cell, lo, size);
+            
+            // Exit face of the cube
+            size_t axis = 0;
+            float exit = std::numeric_limits<float>::infinity();
+            for(size_t a = 0; a < 3; ++a) {
+                if(d[a] == 0)
+                    continue;
+                float bound = d[a] > 0 ? float(lo[a] + size) : float(lo[a]);
+                float te = (bound - origin[a]) / d[a];
+                if(te < exit) {
+                    exit = te;
+                    axis = a;
+                }
+            }
+            
+            if(exit > t_max)
+                return result;
+            t = std::max(t, exit);
+            
+            // The cell across the exit face, next to the exit point
+            if(d[axis] > 0 ? lo[axis] + size > voxel::max_coordinate
+                           : lo[axis] == 0)
+                return result;
+            
+            p = origin + d * t;
+            for(size_t a = 0; a < 3; ++a) {
+                if(a == axis) {
+                    cell[a] = d[a] > 0 ? lo[a] + size : lo[a] - 1;
+                    continue;
+                }
+                float c = std::floor(p[a]);
+                c = std::max(c, float(lo[a]));
+                c = std::min(c, float(lo[a] + size - 1));
+                cell[a] = uint32_t(c);
+            }
+        }
+    }
+    
+    void octree::raycast(glm::vec3 const *origins,
+                         glm::vec3 const *directions, size_t count,
+                         ray_hit *result, float max_distance,
+                         unsigned threads) const
+    {
+        if(threads == 0)
+            threads = concurrency();
+        
+        parallel_for((count + packet - 1) / packet, [&](size_t t) {
+            size_t last = std::min(count, (t + 1) * packet);
+            for(size_t i = t * packet; i < last; ++i)
+                result[i] = raycast(origins[i], directions[i], max_distance);
+        }, threads);
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "render.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+    // Colors easy to tell apart, also by color blind people
+    static const glm::u8vec3 palette[] = {
+        glm::u8vec3(230, 159,   0), glm::u8vec3( 86, 180, 233),
+        glm::u8vec3(  0, 158, 115), glm::u8vec3(240, 228,  66),
+        glm::u8vec3(  0, 114, 178), glm::u8vec3(213,  94,   0),
+        glm::u8vec3(204, 121, 167), glm::u8vec3(153, 153, 153)
+    };
+    
+    static const size_t palette_size = sizeof(palette) / sizeof(palette[0]);
+    
+    static const glm::u8vec3 background(40, 40, 48);
+    
+    glm::u8vec3 material_color(voxel::material_t material)
+    {
+        if(material == voxel::void_material ||
+           material == voxel::unknown_material)
+            return glm::u8vec3(0, 0, 0);
+        
+        // The first material of a scene is the one after void
+        return palette[(material - voxel::void_material - 1) % palette_size];
+    }
+    
+    /*
+     * Distance from the whole scene, that is, from the nearest object
+     */
+    static void scene_distances(csg::scene const&scene,
+                                glm::vec3 const *points, size_t count,
+                                float *result, std::vector<float> &scratch)
+    {
+        scratch.resize(count);
+        std::fill(result, result + count,
+                  std::numeric_limits<float>::infinity());
+        
+        for(auto *obj : scene) {
+            obj->distances(points, scratch.data(), count);
+            for(size_t i = 0; i < count; ++i)
+                result[i] = std::min(result[i], scratch[i]);
+        }
+    }
+    
+    struct camera {
+        glm::vec3 eye;
+        glm::vec3 forward, right, up;
+        float near, far;
+        float half_width, half_height;
+        float pixel; // Angular size of a pixel
+    };
+    
+    static void trace_tile(csg::scene const&scene, camera const&cam,
+                           render_options const&options,
+                           unsigned x0, unsigned y0, uint8_t *image)
+    {
+        unsigned x1 = std::min(options.width, x0 + options.tile);
+        unsigned y1 = std::min(options.height, y0 + options.tile);
+        
+        std::vector<size_t> pixels;
+        std::vector<glm::vec3> directions;
+        std::vector<float> t;
+        
+        for(unsigned y = y0; y < y1; ++y)
+            for(unsigned x = x0; x < x1; ++x) {
+                float u = (2 * (x + 0.5f) / options.width - 1) *
+                          cam.half_width;
+                float v = (1 - 2 * (y + 0.5f) / options.height) *
+                          cam.half_height;
+                
+                pixels.push_back(size_t(y) * options.width + x);
+                directions.push_back(glm::normalize(cam.forward +
+                                                    cam.right * u +
+                                                    cam.up * v));
+                t.push_back(cam.near);
+            }
+        
+        /*
+         * Marching of all the rays of the tile together
+         */
+        std::vector<size_t> active(pixels.size());
+        for(size_t i = 0; i < active.size(); ++i)
+            active[i] = i;
+        
+        std::vector<size_t> hits;
+        std::vector<glm::vec3> points;
+        std::vector<float> distances, scratch;
+        
+        for(unsigned step = 0; step < options.max_steps && !active.empty();
+            ++step)
+        {
+            points.resize(active.size());
+            distances.resize(active.size());
+            for(size_t k = 0; k < active.size(); ++k)
+                points[k] = cam.eye + directions[active[k]] * t[active[k]];
+            
+            scene_distances(scene, points.data(), points.size(),
+                            distances.data(), scratch);
+            
+            size_t still = 0;
+            for(size_t k = 0; k < active.size(); ++k) {
+                size_t r = active[k];
+                if(distances[k] < cam.pixel * t[r]) {
+                    hits.push_back(r);
+                    continue;
+                }
+                
+                t[r] += distances[k] * options.step;
+                if(t[r] < cam.far)
+                    active[still++] = r;
+            }
+            active.resize(still);
+        }
+        
+        for(size_t i = 0; i < pixels.size(); ++i)
+            for(size_t c = 0; c < 3; ++c)
+                image[pixels[i] * 3 + c] = background[c];
+        
+        if(hits.empty())
+            return;
+        
+        /*
+         * Normals by central differences, with a step as large as the
+         * footprint of the pixel, then materials
+         */
+        size_t n = hits.size();
+        points.resize(n * 6);
+        distances.resize(n * 6);
+        for(size_t k = 0; k < n; ++k) {
+            size_t r = hits[k];
+            glm::vec3 p = cam.eye + directions[r] * t[r];
+            float h = cam.pixel * t[r];
+            for(size_t axis = 0; axis < 3; ++axis) {
+                glm::vec3 d(0, 0, 0);
+                d[axis] = h;
+                points[k * 6 + axis * 2] = p + d;
+                points[k * 6 + axis * 2 + 1] = p - d;
+            }
+        }
+        scene_distances(scene, points.data(), points.size(),
+                        distances.data(), scratch);
+        
+        std::vector<glm::vec3> normals(n);
+        for(size_t k = 0; k < n; ++k) {
+            glm::vec3 g(distances[k * 6 + 0] - distances[k * 6 + 1],
+                        distances[k * 6 + 2] - distances[k * 6 + 3],
+                        distances[k * 6 + 4] - distances[k * 6 + 5]);
+            float length = glm::length(g);
+            normals[k] = length > 0 ? g / length : -directions[hits[k]];
+        }
+        
+        // The first object that contains the hit point, allowing for the
+        // tolerance of the hit, or else the nearest one
+        points.resize(n);
+        for(size_t k = 0; k < n; ++k)
+            points[k] = cam.eye + directions[hits[k]] * t[hits[k]];
+        
+        std::vector<voxel::material_t> materials(
+                                n, voxel::material_t(voxel::void_material));
+        std::vector<float> nearest(n, std::numeric_limits<float>::infinity());
+        std::vector<uint8_t> inside(n, false);
+        distances.resize(n);
+        for(auto *obj : scene) {
+            obj->distances(points.data(), distances.data(), n);
+            for(size_t k = 0; k < n; ++k) {
+                if(inside[k])
+                    continue;
+                if(distances[k] < cam.pixel * t[hits[k]]) {
+                    inside[k] = true;
+                    materials[k] = obj->material();
+                } else if(distances[k] < nearest[k]) {
+                    nearest[k] = distances[k];
+                    materials[k] = obj->material();
+                }
+            }
+        }
+        
+        for(size_t k = 0; k < n; ++k) {
+            float shade = std::abs(glm::dot(normals[k], directions[hits[k]]));
+            shade = 0.25f + 0.75f * shade;
+            
+            glm::u8vec3 color = material_color(materials[k]);
+            for(size_t c = 0; c < 3; ++c)
+                image[pixels[hits[k]] * 3 + c] = uint8_t(color[c] * shade);
+        }
+    }
+    
+    void render(csg::scene const&scene, std::ostream &out,
+                render_options const&options)
+    {
+        unsigned threads = options.threads ? options.threads : concurrency();
+        
+        csg::bounding_box box = scene.bounding_box();
+        glm::vec3 center = box.min() + glm::vec3(box.side() / 2,
+                                                 box.side() / 2,
+                                                 box.side() / 2);
+        float radius = std::sqrt(3.0f) * box.side() / 2;
+        
+        float fov = options.fov * float(M_PI) / 180;
+        float aspect = float(options.width) / options.height;
+        
+        // Far enough for the bounding sphere to fit the narrowest side
+        float distance = radius / std::sin(fov / 2 * std::min(1.0f, aspect));
+        
+        camera cam;
+        cam.forward = -glm::normalize(options.view);
+        cam.eye = center - cam.forward * distance;
+        
+        glm::vec3 up = std::abs(cam.forward.y) > 0.99f ? glm::vec3(0, 0, 1)
+                                                        : glm::vec3(0, 1, 0);
+        cam.right = glm::normalize(glm::cross(cam.forward, up));
+        cam.up = glm::cross(cam.right, cam.forward);
+        
+        cam.near = distance - radius;
+        cam.far = distance + radius;
+        cam.half_height = std::tan(fov / 2);
+        cam.half_width = cam.half_height * aspect;
+        cam.pixel = 2 * cam.half_height / options.height;
+        
+        std::vector<uint8_t> image(size_t(options.width) * options.height * 3);
+        
+        unsigned columns = (options.width + options.tile - 1) / options.tile;
+        unsigned rows = (options.height + options.tile - 1) / options.tile;
+        
+        parallel_for(size_t(columns) * rows, [&](size_t i) {
+            trace_tile(scene, cam, options,
+                       unsigned(i % columns) * options.tile,
+                       unsigned(i / columns) * options.tile, image.data());
+        }, threads);
+        
+        out << "P6\n" << options.width << " " << options.height << "\n255\n";
+        out.write(reinterpret_cast<char const *>(image.data()),
+                  std::streamsize(image.size()));
+    }
+    
+} // namespace details
+} // namespace ocmesh
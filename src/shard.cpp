@@ -0,0 +1,250 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+namespace ocmesh {
+namespace details {
+    
+    /*
+     * A sorted run of leaves produced by a worker process.
+     * The file is unlinked as soon as it's created, so nothing is left
+     * behind if anything goes wrong: the descriptor is inherited by the
+     * worker and the data disappears when the coordinator closes it.
+     */
+    class run_file
+    {
+    public:
+        explicit run_file(std::string const&directory)
+        {
+            std::string path = directory + "/ocmesh-run-XXXXXX";
+            
+            _fd = mkstemp(&path[0]);
+            if(_fd != -1)
+                unlink(path.c_str());
+        }
+        
+        run_file(run_file const&) = delete;
+        run_file(run_file &&other) : _fd(other._fd) { other._fd = -1; }
+        
+        ~run_file() {
+            if(_fd != -1)
+                close(_fd);
+        }
+        
+        bool valid() const { return _fd != -1; }
+        
+        // Called by the worker
+        bool write(voxel const *data, size_t count)
+        {
+            char const *p = reinterpret_cast<char const *>(data);
+            size_t bytes = count * sizeof(voxel);
+            
+            while(bytes > 0) {
+                ssize_t n = ::write(_fd, p, bytes);
+                if(n <= 0)
+                    return false;
+                p += n;
+                bytes -= size_t(n);
+            }
+            
+            return true;
+        }
+        
+        // Called by the coordinator, once the worker has finished
+        template<typename F>
+        bool read(F const&f) const
+        {
+            struct stat st;
+            if(fstat(_fd, &st) != 0 || st.st_size % sizeof(voxel) != 0)
+                return false;
+            
+            size_t bytes = size_t(st.st_size);
+            if(bytes == 0)
+                return true;
+            
+            void *p = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, _fd, 0);
+            if(p == MAP_FAILED)
+                return false;
+            
+            voxel const *data = static_cast<voxel const *>(p);
+            f(data, data + bytes / sizeof(voxel));
+            
+            munmap(p, bytes);
+            return true;
+        }
+        
+    private:
+        int _fd = -1;
+    };
+    
+    static std::string run_directory(shard_options const&options)
+    {
+        if(!options.directory.empty())
+            return options.directory;
+        
+        struct stat st;
+        if(stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode))
+            return "/dev/shm";
+        
+        char const *tmp = std::getenv("TMPDIR");
+        return tmp ? tmp : P_tmpdir;
+    }
+    
+    bool octree::build_sharded(split_function_t split_function,
+                               shard_options const&options)
+    {
+        assert(options.depth <= voxel::max_level && "Shard depth too large");
+        
+        _data.clear();
+        _attributes.clear();
+        
+        std::vector<voxel> leaves;
+        std::vector<voxel> shards;
+        expand(split_function, options.depth, leaves, shards);
+        leaves.erase(drop_void(leaves.begin(), leaves.end()), leaves.end());
+        
+        /*
+         * Workers. At most options.processes of them are running at the
+         * same time. Each one builds its shard as a standalone octree.
+         */
+        std::string directory = run_directory(options);
+        std::vector<run_file> runs;
+        for(size_t i = 0; i < shards.size(); ++i) {
+            runs.emplace_back(directory);
+            if(!runs.back().valid())
+                return false;
+        }
+        
+        unsigned processes = options.processes ? options.processes
+                                               : concurrency();
+        
+        bool ok = true;
+        std::vector<pid_t> workers;
+        
+        /*
+         * Waits for one of the workers, and only for them, since the host
+         * process may have children of its own. If they can't be waited
+         * for at all (ECHILD), because the host ignores SIGCHLD or someone
+         * else reaped them, the build fails instead of waiting forever.
+         */
+        auto reap = [&]() {
+            int status = 0;
+            pid_t pid = 0;
+            
+            // A worker that already exited, or else the oldest one
+            for(size_t k = 0; k < workers.size() && pid == 0; ++k)
+                pid = waitpid(workers[k], &status, WNOHANG);
+            while(pid == 0 || (pid == -1 && errno == EINTR))
+                pid = waitpid(workers.front(), &status, 0);
+            
+            if(pid == -1) {
+                ok = false;
+                workers.clear();
+                return;
+            }
+            
+            workers.erase(std::find(workers.begin(), workers.end(), pid));
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                ok = false;
+        };
+        
+        for(size_t i = 0; i < shards.size() && ok; ++i) {
+            while(workers.size() >= processes && ok)
+                reap();
+            if(!ok)
+                break;
+            
+            pid_t pid = fork();
+            if(pid == -1) {
+                ok = false;
+                break;
+            }
+            
+            /*
+             * _exit() to avoid running the coordinator's atexit handlers or
+             * flushing its stdio buffers a second time. Exceptions must not
+             * escape either, or the worker would go on as a second copy of
+             * the caller: they become a failed exit status.
+             */
+            if(pid == 0) {
+                bool written = false;
+                try {
+                    octree shard(_storage);
+                    shard._data.push_back(shards[i]);
+                    shard.subdivide(split_function, 0);
+                    shard._data.erase(drop_void(shard._data.begin(),
+                                                shard._data.end()),
+                                      shard._data.end());
+                    std::sort(shard._data.begin(), shard._data.end());
+                    
+                    written = runs[i].write(shard._data.data(),
+                                            shard._data.size());
+                } catch(...) {
+                    _exit(1);
+                }
+                
+                _exit(written ? 0 : 1);
+            }
+            
+            workers.push_back(pid);
+        }
+        
+        while(!workers.empty())
+            reap();
+        
+        if(!ok)
+            return false;
+        
+        /*
+         * Merge. Shards and coarse leaves cover disjoint ranges of Morton
+         * codes, so we only have to interleave them in order.
+         */
+        auto leaf = leaves.begin();
+        for(size_t i = 0; i < shards.size() && ok; ++i) {
+            while(leaf != leaves.end() && *leaf < shards[i])
+                _data.push_back(*leaf++);
+            
+            ok = runs[i].read([&](voxel const *first, voxel const *last) {
+                _data.insert(_data.end(), first, last);
+            });
+        }
+        _data.insert(_data.end(), leaf, leaves.end());
+        
+        if(!ok)
+            _data.clear();
+        
+        _stats = build_stats();
+        _stats.leaves = _data.size();
+        _stats.tasks = shards.size();
+        
+        return ok;
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slice.h"
+#include "parallel.h"
+#include "render.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ocmesh {
+namespace details {
+    
+    // Level of the nodes rasterized by each parallel task
+    static const voxel::level_t task_level = 3;
+    
+    /*
+     * Top-down rasterization of the nodes crossed by the plane. Each node
+     * is visited with the range of leaves that lie inside it, which is
+     * empty in the gaps of sparse octrees, and is a single leaf as large
+     * as the node when the node is a leaf.
+     */
+    class slicer
+    {
+    public:
+        slicer(octree const&oc, uint8_t axis, uint16_t position,
+               slice_image &image)
+            : _oc(oc), _axis(axis), _position(position), _image(image),
+              _u((axis + 1) % 3), _v((axis + 2) % 3),
+              _pixel(double(uint32_t(1) << voxel::max_level) /
+                     image.width()) { }
+        
+        void visit(uint64_t m, voxel::level_t level,
+                   octree::const_iterator first, octree::const_iterator last)
+        {
+            glm::u32vec3 origin = unmorton(m);
+            uint32_t size = uint32_t(1) << (voxel::max_level - level);
+            
+            unsigned u0, u1, v0, v1;
+            if(!pixels(origin[_u], size, u0, u1) ||
+               !pixels(origin[_v], size, v0, v1))
+                return;
+            
+            if(first == last) {
+                paint(u0, u1, v0, v1, voxel::void_material);
+                return;
+            }
+            
+            if(first->level() <= level) {
+                paint(u0, u1, v0, v1, first->material());
+                return;
+            }
+            
+            uint64_t span = uint64_t(1) << (3 * (voxel::max_level - level - 1));
+            uint32_t half = size / 2;
+            for(uint64_t c = 0; c < 8; ++c) {
+                glm::u32vec3 corner = unmorton(c);
+                uint32_t low = origin[_axis] + corner[_axis] * half;
+                if(_position < low || _position >= low + half)
+                    continue;
+                
+                uint64_t child = m + c * span;
+                auto begin = std::lower_bound(first, last,
+                                              voxel(child, 0, 0));
+                auto end = std::lower_bound(begin, last,
+                                            voxel(child + span, 0, 0));
+                visit(child, voxel::level_t(level + 1), begin, end);
+            }
+        }
+        
+        // Rasterizes a node at the level of the parallel tasks
+        void task(uint64_t m, voxel::level_t level)
+        {
+            glm::u32vec3 origin = unmorton(m);
+            octree::const_iterator it = _oc.locate(glm::u16vec3(origin));
+            
+            // Covered by a larger leaf
+            if(it != _oc.end() && it->level() <= level) {
+                uint32_t size = uint32_t(1) << (voxel::max_level - level);
+                unsigned u0, u1, v0, v1;
+                if(pixels(origin[_u], size, u0, u1) &&
+                   pixels(origin[_v], size, v0, v1))
+                    paint(u0, u1, v0, v1, it->material());
+                return;
+            }
+            
+            uint64_t span = uint64_t(1) << (3 * (voxel::max_level - level));
+            auto begin = std::lower_bound(_oc.begin(), _oc.end(),
+                                          voxel(m, 0, 0));
+            auto end = std::lower_bound(begin, _oc.end(),
+                                        voxel(m + span, 0, 0));
+            visit(m, level, begin, end);
+        }
+    
+    private:
+        // Pixels whose centers fall in [low, low + size), if any
+        bool pixels(uint32_t low, uint32_t size,
+                    unsigned &first, unsigned &last) const
+        {
+            double a = std::ceil(low / _pixel - 0.5);
+            double b = std::ceil((low + size) / _pixel - 0.5);
+            first = unsigned(std::max(a, 0.0));
+            last = unsigned(std::min(b, double(_image.width())));
+            return first < last;
+        }
+        
+        void paint(unsigned u0, unsigned u1, unsigned v0, unsigned v1,
+                   voxel::material_t material)
+        {
+            unsigned n = _image.height();
+            for(unsigned v = v0; v < v1; ++v)
+                std::fill(_image.labels().begin() + (n - 1 - v) * n + u0,
+                          _image.labels().begin() + (n - 1 - v) * n + u1,
+                          material);
+        }
+    
+    private:
+        octree const&_oc;
+        uint8_t _axis;
+        uint16_t _position;
+        slice_image &_image;
+        uint8_t _u, _v;
+        double _pixel;
+    };
+    
+    slice_image octree::slice(uint8_t axis, uint16_t position,
+                              unsigned resolution, unsigned threads) const
+    {
+        assert(axis < 3 && "Invalid slice axis");
+        assert(position <= voxel::max_coordinate && "Invalid slice position");
+        
+        if(threads == 0)
+            threads = concurrency();
+        
+        slice_image image(resolution);
+        slicer s(*this, axis, position, image);
+        
+        // Nodes of the task level crossed by the plane
+        std::vector<uint64_t> nodes;
+        uint32_t size = uint32_t(1) << (voxel::max_level - task_level);
+        for(uint64_t m = 0; m < (uint64_t(1) << (3 * task_level)); ++m) {
+            uint64_t code = m << (3 * (voxel::max_level - task_level));
+            glm::u32vec3 origin = unmorton(code);
+            if(position >= origin[axis] && position < origin[axis] + size)
+                nodes.push_back(code);
+        }
+        
+        parallel_for(nodes.size(), [&](size_t i) {
+            s.task(nodes[i], task_level);
+        }, threads);
+        
+        return image;
+    }
+    
+    void slice_image::write(std::ostream &out, format_t format) const
+    {
+        switch(format) {
+            case pgm: {
+                voxel::material_t top = 1;
+                for(voxel::material_t m : _labels)
+                    top = std::max(top, m);
+                top = std::min(top, voxel::material_t(65535));
+                
+                out << "P5\n" << width() << " " << height() << "\n"
+                    << top << "\n";
+                
+                std::vector<uint8_t> bytes;
+                bytes.reserve(_labels.size() * (top > 255 ? 2 : 1));
+                for(voxel::material_t m : _labels) {
+                    m = std::min(m, top);
+                    if(top > 255)
+                        bytes.push_back(uint8_t(m >> 8));
+                    bytes.push_back(uint8_t(m));
+                }
+                out.write(reinterpret_cast<char const *>(bytes.data()),
+                          std::streamsize(bytes.size()));
+                return;
+            }
+            case ppm: {
+                out << "P6\n" << width() << " " << height() << "\n255\n";
+                
+                std::vector<uint8_t> bytes;
+                bytes.reserve(_labels.size() * 3);
+                for(voxel::material_t m : _labels) {
+                    glm::u8vec3 color = material_color(m);
+                    bytes.push_back(color.x);
+                    bytes.push_back(color.y);
+                    bytes.push_back(color.z);
+                }
+                out.write(reinterpret_cast<char const *>(bytes.data()),
+                          std::streamsize(bytes.size()));
+                return;
+            }
+            case raw:
+                out.write(reinterpret_cast<char const *>(_labels.data()),
+                          std::streamsize(_labels.size() *
+                                          sizeof(voxel::material_t)));
+                return;
+        }
+    }
+    
+} // namespace details
+} // namespace ocmesh
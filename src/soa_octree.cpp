@@ -0,0 +1,176 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "soa_octree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <set>
+
+namespace ocmesh {
+namespace details {
+    
+    constexpr size_t soa_octree::npos;
+    
+    // Leaves converted by each parallel task
+    static const size_t chunk = 1 << 16;
+    
+    soa_octree::soa_octree(octree const&oc)
+        : _storage(oc.storage()), _keys(oc.size())
+    {
+        size_t tasks = (oc.size() + chunk - 1) / chunk;
+        
+        /*
+         * Distinct materials of each range of leaves, merged at the end, so
+         * the palette only ever holds the materials in use. Runs of leaves
+         * of the same material are looked up once.
+         */
+        std::vector<std::set<voxel::material_t>> used(tasks);
+        parallel_for(tasks, [&](size_t c) {
+            size_t last = std::min(oc.size(), (c + 1) * chunk);
+            
+            voxel::material_t previous = voxel::unknown_material;
+            for(size_t i = c * chunk; i < last; ++i) {
+                voxel::material_t m = oc.begin()[ptrdiff_t(i)].material();
+                if(i == c * chunk || m != previous)
+                    used[c].insert(m);
+                previous = m;
+            }
+        });
+        
+        std::set<voxel::material_t> materials;
+        for(auto const&u : used)
+            materials.insert(u.begin(), u.end());
+        _palette.assign(materials.begin(), materials.end());
+        
+        _width = _palette.size() <= (1 << 8)  ? 1 :
+                 _palette.size() <= (1 << 16) ? 2 : 4;
+        
+        _materials.resize(oc.size() * _width);
+        
+        parallel_for(tasks, [&](size_t c) {
+            size_t last = std::min(oc.size(), (c + 1) * chunk);
+            
+            for(size_t i = c * chunk; i < last; ++i) {
+                voxel v = oc.begin()[ptrdiff_t(i)];
+                
+                _keys[i] = key(v);
+                
+                uint32_t p = uint32_t(
+                    std::lower_bound(_palette.begin(), _palette.end(),
+                                     v.material()) - _palette.begin());
+                switch(_width) {
+                    case 1:
+                        store(i, uint8_t(p));
+                        break;
+                    case 2:
+                        store(i, uint16_t(p));
+                        break;
+                    default:
+                        store(i, p);
+                }
+            }
+        });
+    }
+    
+    size_t soa_octree::locate(glm::u16vec3 point) const
+    {
+        uint64_t m = details::morton(glm::u32vec3(point));
+        uint64_t k = m << voxel::level_bits | lowmask(voxel::level_bits);
+        
+        auto it = std::upper_bound(_keys.begin(), _keys.end(), k);
+        if(it == _keys.begin())
+            return npos;
+        
+        size_t i = size_t(it - _keys.begin()) - 1;
+        uint64_t span = uint64_t(1) << (3 * (voxel::max_level - level(i)));
+        
+        return m < morton(i) + span ? i : npos;
+    }
+    
+    voxel::material_t soa_octree::material_at(glm::u16vec3 point) const
+    {
+        size_t i = locate(point);
+        
+        return i != npos ? material(i) : voxel::void_material;
+    }
+    
+    size_t soa_octree::neighbor(size_t i, voxel::face f) const
+    {
+        voxel candidate = (*this)[i].neighbor(f);
+        if(candidate.level() != voxel::max_level)
+            return npos;
+        
+        return locate(candidate.coordinates());
+    }
+    
+    /*
+     * The scan is instantiated for each width, so that the loop doesn't
+     * switch on it at every element, and each load is a memcpy() of a known
+     * size, which compilers turn into a plain load of the given type.
+     */
+    template<typename T>
+    std::vector<size_t> soa_octree::histogram() const
+    {
+        std::vector<size_t> counts(_palette.size(), 0);
+        
+        for(size_t i = 0; i < size(); ++i)
+            ++counts[load<T>(i)];
+        
+        return counts;
+    }
+    
+    std::vector<size_t> soa_octree::histogram() const
+    {
+        switch(_width) {
+            case 1:
+                return histogram<uint8_t>();
+            case 2:
+                return histogram<uint16_t>();
+            default:
+                return histogram<uint32_t>();
+        }
+    }
+    
+    template<typename T>
+    size_t soa_octree::occurrences(T index) const
+    {
+        size_t n = 0;
+        for(size_t i = 0; i < size(); ++i)
+            n += load<T>(i) == index;
+        
+        return n;
+    }
+    
+    size_t soa_octree::count(voxel::material_t material) const
+    {
+        auto p = std::lower_bound(_palette.begin(), _palette.end(), material);
+        if(p == _palette.end() || *p != material)
+            return 0;
+        
+        uint32_t index = uint32_t(p - _palette.begin());
+        switch(_width) {
+            case 1:
+                return occurrences(uint8_t(index));
+            case 2:
+                return occurrences(uint16_t(index));
+            default:
+                return occurrences(index);
+        }
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "statistics.h"
+#include "face_contacts.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <utility>
+
+namespace ocmesh {
+namespace details {
+    
+    // Leaves reduced by each parallel task
+    static const size_t chunk = 1 << 12;
+    
+    // Side of the domain, and its center, used as the origin of the sums
+    // to keep the second moments well conditioned
+    static const double domain = double(uint64_t(1) << voxel::max_level);
+    static const double middle = domain / 2;
+    
+    /*
+     * Volume, first and second moments of a set of cubes, relative to the
+     * center of the domain. Second moments are xx, yy, zz, xy, yz, zx.
+     */
+    struct moments {
+        size_t leaves = 0;
+        double volume = 0;
+        std::array<double, 3> first = {{ 0, 0, 0 }};
+        std::array<double, 6> second = {{ 0, 0, 0, 0, 0, 0 }};
+        
+        void add(voxel v) {
+            double s = v.size();
+            double V = s * s * s;
+            glm::u16vec3 c = v.coordinates();
+            double x = c.x + s / 2 - middle;
+            double y = c.y + s / 2 - middle;
+            double z = c.z + s / 2 - middle;
+            
+            ++leaves;
+            volume += V;
+            first[0] += V * x;
+            first[1] += V * y;
+            first[2] += V * z;
+            second[0] += V * (x * x + s * s / 12);
+            second[1] += V * (y * y + s * s / 12);
+            second[2] += V * (z * z + s * s / 12);
+            second[3] += V * x * y;
+            second[4] += V * y * z;
+            second[5] += V * z * x;
+        }
+        
+        moments &operator+=(moments const&m) {
+            leaves += m.leaves;
+            volume += m.volume;
+            for(size_t i = 0; i < 3; ++i)
+                first[i] += m.first[i];
+            for(size_t i = 0; i < 6; ++i)
+                second[i] += m.second[i];
+            return *this;
+        }
+    };
+    
+    using material_pair = std::pair<voxel::material_t, voxel::material_t>;
+    
+    struct partial {
+        std::map<voxel::material_t, moments> materials;
+        std::map<material_pair, double> interfaces;
+    };
+    
+    /*
+     * Each interface is counted once, by the smaller of the two leaves, or
+     * by the one on the negative side if they have the same size. Across
+     * gaps of sparse octrees there are no leaves, so the solid leaf counts
+     * the interface with the void by itself.
+     */
+    static void leaf_interfaces(octree const&oc, octree::const_iterator leaf,
+                                std::map<material_pair, double> &result)
+    {
+        voxel::material_t m = leaf->material();
+        glm::u16vec3 c = leaf->coordinates();
+        uint32_t size = leaf->size();
+        
+        for_each_contact(oc, leaf, [&](face_contact const&f) {
+            uint8_t axis = f.side / 2;
+            bool positive = f.side % 2;
+            
+            voxel::material_t other;
+            if(f.neighbour != oc.end()) {
+                if(f.neighbour->level() > leaf->level())
+                    return;
+                if(f.neighbour->level() == leaf->level() && !positive)
+                    return;
+                other = f.neighbour->material();
+            } else {
+                bool border = positive ? c[axis] + size == domain
+                                       : c[axis] == 0;
+                if(border)
+                    return;
+                other = voxel::void_material;
+            }
+            
+            if(other == m)
+                return;
+            
+            double area = double(f.size) * f.size;
+            result[{ std::min(m, other), std::max(m, other) }] += area;
+        });
+    }
+    
+    material_statistics::material_statistics(octree const&oc,
+                                             unsigned threads)
+    {
+        compute(oc, glm::dvec3(0, 0, 0), 1, threads);
+    }
+    
+    material_statistics::material_statistics(octree const&oc,
+                                             csg::scene const&scene,
+                                             unsigned threads)
+    {
+        // The same mapping of the scene builder
+        csg::bounding_box box = scene.bounding_box();
+        compute(oc, glm::dvec3(box.min()),
+                double(box.side()) / voxel::max_coordinate, threads);
+    }
+    
+    void material_statistics::compute(octree const&oc, glm::dvec3 origin,
+                                      double unit, unsigned threads)
+    {
+        size_t tasks = (oc.size() + chunk - 1) / chunk;
+        std::vector<partial> partials(tasks);
+        
+        parallel_for(tasks, [&](size_t t) {
+            size_t last = std::min(oc.size(), (t + 1) * chunk);
+            for(size_t i = t * chunk; i < last; ++i) {
+                octree::const_iterator leaf = oc.begin() + ptrdiff_t(i);
+                partials[t].materials[leaf->material()].add(*leaf);
+                leaf_interfaces(oc, leaf, partials[t].interfaces);
+            }
+        }, threads);
+        
+        partial total;
+        for(partial const&p : partials) {
+            for(auto const&m : p.materials)
+                total.materials[m.first] += m.second;
+            for(auto const&i : p.interfaces)
+                total.interfaces[i.first] += i.second;
+        }
+        
+        // The void of a sparse octree is the rest of the domain
+        if(oc.storage() == octree::sparse) {
+            voxel::material_t empty = voxel::void_material;
+            moments &rest = total.materials[empty];
+            rest.volume = domain * domain * domain;
+            rest.first = {{ 0, 0, 0 }};
+            rest.second = {{ 0, 0, 0, 0, 0, 0 }};
+            for(size_t i = 0; i < 3; ++i)
+                rest.second[i] = rest.volume * domain * domain / 12;
+            
+            for(auto const&m : total.materials) {
+                if(m.first == empty)
+                    continue;
+                rest.volume -= m.second.volume;
+                for(size_t i = 0; i < 3; ++i)
+                    rest.first[i] -= m.second.first[i];
+                for(size_t i = 0; i < 6; ++i)
+                    rest.second[i] -= m.second.second[i];
+            }
+            
+            if(rest.volume <= 0)
+                total.materials.erase(empty);
+        }
+        
+        double area = unit * unit;
+        double volume = area * unit;
+        
+        _materials.clear();
+        for(auto const&m : total.materials) {
+            moments const&s = m.second;
+            
+            material result;
+            result.id = m.first;
+            result.leaves = s.leaves;
+            result.volume = s.volume * volume;
+            
+            // Central second moments, then the inertia tensor
+            std::array<double, 3> c = {{ 0, 0, 0 }};
+            std::array<double, 6> central = {{ 0, 0, 0, 0, 0, 0 }};
+            if(s.volume > 0) {
+                for(size_t i = 0; i < 3; ++i)
+                    c[i] = s.first[i] / s.volume;
+                for(size_t i = 0; i < 6; ++i) {
+                    size_t a = i < 3 ? i : i - 3;
+                    size_t b = i < 3 ? i : (i - 2) % 3;
+                    central[i] = (s.second[i] - s.volume * c[a] * c[b]) *
+                                 volume * area;
+                }
+            }
+            
+            for(size_t i = 0; i < 3; ++i)
+                result.centroid[i] = origin[i] + (c[i] + middle) * unit;
+            
+            double trace = central[0] + central[1] + central[2];
+            result.inertia = {{
+                trace - central[0], -central[3], -central[5],
+                -central[3], trace - central[1], -central[4],
+                -central[5], -central[4], trace - central[2]
+            }};
+            
+            _materials.push_back(result);
+        }
+        
+        _interfaces.clear();
+        for(auto const&i : total.interfaces)
+            _interfaces.push_back({ i.first.first, i.first.second,
+                                    i.second * area });
+    }
+    
+    void material_statistics::write_json(std::ostream &out) const
+    {
+        std::streamsize precision = out.precision();
+        out.precision(std::numeric_limits<double>::max_digits10);
+        
+        out << "{\n  \"materials\": [";
+        for(size_t i = 0; i < _materials.size(); ++i) {
+            material const&m = _materials[i];
+            out << (i ? ",\n" : "\n")
+                << "    { \"material\": " << m.id
+                << ", \"leaves\": " << m.leaves
+                << ", \"volume\": " << m.volume
+                << ",\n      \"centroid\": [" << m.centroid[0] << ", "
+                << m.centroid[1] << ", " << m.centroid[2] << "]"
+                << ",\n      \"inertia\": [";
+            for(size_t r = 0; r < 3; ++r)
+                out << (r ? ", " : "") << "[" << m.inertia[r * 3] << ", "
+                    << m.inertia[r * 3 + 1] << ", " << m.inertia[r * 3 + 2]
+                    << "]";
+            out << "] }";
+        }
+        
+        out << "\n  ],\n  \"interfaces\": [";
+        for(size_t i = 0; i < _interfaces.size(); ++i) {
+            interface const&f = _interfaces[i];
+            out << (i ? ",\n" : "\n")
+                << "    { \"materials\": [" << f.first << ", " << f.second
+                << "], \"area\": " << f.area << " }";
+        }
+        out << "\n  ]\n}\n";
+        
+        out.precision(precision);
+    }
+    
+} // namespace details
+} // namespace ocmesh
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "parallel.h"
+#include "scene_builder.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+    // Leaves subsampled together by each parallel task. Kept small, since
+    // the subcells of a task grow with the area of the boundaries inside.
+    static const size_t chunk = 256;
+    
+    // Number of subcells classified by a single call of the scene builder
+    static const size_t batch_size = 4096;
+    
+    /*
+     * Subsampling works level-synchronously on the cells of a chunk of
+     * leaves, starting from the leaves themselves. The cells of each depth
+     * are classified in batches. Cells that no boundary crosses, and the
+     * ones at the maximum depth, add their weight to the fraction of their
+     * material in the leaf they come from. The others are split in eight
+     * children of the next depth.
+     */
+    void octree::compute_volume_fractions(csg::scene const&scene,
+                                          uint8_t depth, unsigned threads)
+    {
+        if(threads == 0)
+            threads = concurrency();
+        
+        // The precision only matters to the build, not to the sampling
+        scene_builder builder(scene, 0);
+        
+        std::vector<voxel::material_t> materials = { voxel::void_material };
+        for(auto *obj : scene)
+            materials.push_back(obj->material());
+        std::sort(materials.begin(), materials.end());
+        materials.erase(std::unique(materials.begin(), materials.end()),
+                        materials.end());
+        
+        auto index = [&](voxel::material_t m) {
+            return size_t(std::lower_bound(materials.begin(), materials.end(),
+                                           m) - materials.begin());
+        };
+        
+        std::vector<leaf_attribute> fractions;
+        for(voxel::material_t m : materials)
+            fractions.emplace_back("volume_fraction_" + std::to_string(m),
+                                   size());
+        
+        size_t tasks = (size() + chunk - 1) / chunk;
+        parallel_for(tasks, [&](size_t t) {
+            size_t first = t * chunk;
+            size_t n = std::min(chunk, size() - first);
+            
+            std::vector<glm::vec3> centers;
+            std::vector<float> sides;
+            std::vector<uint32_t> owners;
+            std::vector<float> weights;
+            
+            for(size_t i = first; i < first + n; ++i) {
+                voxel v = _data[i];
+                float side = v.size();
+                centers.push_back(glm::vec3(v.coordinates()) +
+                                  glm::vec3(side / 2, side / 2, side / 2));
+                sides.push_back(side);
+                owners.push_back(uint32_t(i - first));
+                weights.push_back(1);
+            }
+            
+            std::vector<float> volumes(n * materials.size(), 0);
+            std::vector<voxel::material_t> found;
+            std::vector<uint8_t> cut;
+            
+            for(uint8_t d = 0; !centers.empty(); ++d) {
+                size_t count = centers.size();
+                found.resize(count);
+                cut.resize(count);
+                
+                for(size_t b = 0; b < count; b += batch_size)
+                    builder.sample(centers.data() + b, sides.data() + b,
+                                   std::min(batch_size, count - b),
+                                   found.data() + b, cut.data() + b);
+                
+                std::vector<glm::vec3> next_centers;
+                std::vector<float> next_sides;
+                std::vector<uint32_t> next_owners;
+                std::vector<float> next_weights;
+                
+                for(size_t c = 0; c < count; ++c) {
+                    uint32_t owner = owners[c];
+                    
+                    if(!cut[c] || d == depth) {
+                        // Leaves not cut at all keep their own material
+                        voxel::material_t m = d == 0 ?
+                            _data[first + owner].material() : found[c];
+                        size_t k = index(m);
+                        if(k < materials.size() && materials[k] == m)
+                            volumes[owner * materials.size() + k] +=
+                                weights[c];
+                        continue;
+                    }
+                    
+                    float half = sides[c] / 2;
+                    for(unsigned child = 0; child < 8; ++child) {
+                        glm::vec3 offset((child & 1) ? half / 2 : -half / 2,
+                                         (child & 2) ? half / 2 : -half / 2,
+                                         (child & 4) ? half / 2 : -half / 2);
+                        next_centers.push_back(centers[c] + offset);
+                        next_sides.push_back(half);
+                        next_owners.push_back(owner);
+                        next_weights.push_back(weights[c] / 8);
+                    }
+                }
+                
+                centers.swap(next_centers);
+                sides.swap(next_sides);
+                owners.swap(next_owners);
+                weights.swap(next_weights);
+            }
+            
+            for(size_t i = 0; i < n; ++i)
+                for(size_t k = 0; k < materials.size(); ++k)
+                    fractions[k].set(first + i,
+                                     volumes[i * materials.size() + k]);
+        }, threads);
+        
+        for(leaf_attribute &attribute : fractions)
+            set_attribute(std::move(attribute));
+    }
+    
+} // namespace details
+} // namespace ocmesh
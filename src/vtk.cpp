@@ -0,0 +1,344 @@
+/*
+ * Copyright 2014 Nicola Gigante
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "octree.h"
+#include "hexahedra.h"
+#include "async_file.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ocmesh {
+namespace details {
+    
+    static const uint8_t vtk_hexahedron = 12;
+    
+    /*
+     * A data array of a VTU file, already in its binary form, to be written
+     * in the appended section of the file
+     */
+    struct data_array {
+        std::string type;
+        std::string name;
+        unsigned components;
+        std::vector<char> bytes;
+    };
+    
+    template<typename T>
+    static data_array make_array(std::string type, std::string name,
+                                 unsigned components,
+                                 std::vector<T> const&values)
+    {
+        char const *data = reinterpret_cast<char const *>(values.data());
+        
+        return { std::move(type), std::move(name), components,
+                 std::vector<char>(data, data + values.size() * sizeof(T)) };
+    }
+    
+    static char const *byte_order() {
+        uint16_t probe = 1;
+        return *reinterpret_cast<uint8_t *>(&probe) ? "LittleEndian"
+                                                    : "BigEndian";
+    }
+    
+    static void header(std::ostream &out, char const *type)
+    {
+        out << "<?xml version=\"1.0\"?>\n"
+            << "<VTKFile type=\"" << type << "\" version=\"1.0\" "
+            << "byte_order=\"" << byte_order() << "\" "
+            << "header_type=\"UInt64\">\n";
+    }
+    
+    /*
+     * Arrays of a single piece, grouped by the section of the file
+     */
+    struct vtu_piece {
+        data_array points;
+        std::vector<data_array> cells;
+        std::vector<data_array> point_data;
+        std::vector<data_array> cell_data;
+        
+        size_t number_of_points;
+        size_t number_of_cells;
+    };
+    
+    class vtu_writer
+    {
+    public:
+        explicit vtu_writer(std::ostream &out) : _out(out) { }
+        
+        void write(vtu_piece const&piece)
+        {
+            header(_out, "UnstructuredGrid");
+            _out << "  <UnstructuredGrid>\n"
+                 << "    <Piece NumberOfPoints=\"" << piece.number_of_points
+                 << "\" NumberOfCells=\"" << piece.number_of_cells << "\">\n";
+            
+            section("Points", "", { &piece.points });
+            section("Cells", "", pointers(piece.cells));
+            section("PointData", "", pointers(piece.point_data));
+            section("CellData", "material", pointers(piece.cell_data));
+            
+            _out << "    </Piece>\n"
+                 << "  </UnstructuredGrid>\n"
+                 << "  <AppendedData encoding=\"raw\">\n_";
+            
+            for(data_array const *array : _arrays) {
+                uint64_t size = array->bytes.size();
+                _out.write(reinterpret_cast<char const *>(&size), sizeof(size));
+                _out.write(array->bytes.data(),
+                           std::streamsize(array->bytes.size()));
+            }
+            
+            _out << "\n  </AppendedData>\n"
+                 << "</VTKFile>\n";
+        }
+        
+    private:
+        static std::vector<data_array const *>
+        pointers(std::vector<data_array> const&arrays)
+        {
+            std::vector<data_array const *> result;
+            for(data_array const&array : arrays)
+                result.push_back(&array);
+            return result;
+        }
+        
+        void section(char const *name, char const *scalars,
+                     std::vector<data_array const *> const&arrays)
+        {
+            _out << "      <" << name;
+            if(*scalars)
+                _out << " Scalars=\"" << scalars << "\"";
+            _out << ">\n";
+            
+            for(data_array const *array : arrays) {
+                _out << "        <DataArray type=\"" << array->type << "\" "
+                     << "Name=\"" << array->name << "\" "
+                     << "NumberOfComponents=\"" << array->components << "\" "
+                     << "format=\"appended\" offset=\"" << _offset << "\"/>\n";
+                
+                _offset += sizeof(uint64_t) + array->bytes.size();
+                _arrays.push_back(array);
+            }
+            
+            _out << "      </" << name << ">\n";
+        }
+        
+        std::ostream &_out;
+        uint64_t _offset = 0;
+        std::vector<data_array const *> _arrays;
+    };
+    
+    static void pvtu_section(std::ostream &out, char const *name,
+                             char const *scalars,
+                             std::vector<data_array> const&arrays)
+    {
+        out << "    <" << name;
+        if(*scalars)
+            out << " Scalars=\"" << scalars << "\"";
+        out << ">\n";
+        
+        for(data_array const&array : arrays)
+            out << "      <PDataArray type=\"" << array.type << "\" "
+                << "Name=\"" << array.name << "\" "
+                << "NumberOfComponents=\"" << array.components << "\"/>\n";
+        
+        out << "    </" << name << ">\n";
+    }
+    
+    /*
+     * Partitioned export.
+     *
+     * The solid leaves are split in contiguous Morton ranges with the same
+     * number of leaves, which are spatially compact thanks to the Morton
+     * order. Nodes are first merged over the whole mesh, then each piece
+     * renumbers the nodes it uses, keeping their global index in the
+     * GlobalNodeId array. A node used by more than one piece is marked
+     * in the 'shared' array, so readers can stitch the pieces together.
+     */
+    bool octree::mesh_partitioned(std::string const&path,
+                                  unsigned pieces) const
+    {
+        std::vector<voxel> solid;
+        std::vector<size_t> leaves; // Leaf index of each solid leaf
+        for(size_t i = 0; i < size(); ++i) {
+            voxel v = _data[i];
+            assert(v.material() != voxel::unknown_material);
+            if(v.material() != voxel::void_material) {
+                solid.push_back(v);
+                leaves.push_back(i);
+            }
+        }
+        
+        hexahedra hexes = make_hexahedra(solid.data(), solid.size());
+        
+        if(pieces == 0)
+            pieces = concurrency();
+        pieces = unsigned(std::max<size_t>(1, std::min<size_t>(pieces,
+                                                               solid.size())));
+        
+        auto first_leaf = [&](size_t p) {
+            return p * solid.size() / pieces;
+        };
+        
+        // Nodes of each piece, as sorted global indexes
+        std::vector<std::vector<uint64_t>> nodes(pieces);
+        std::unique_ptr<std::atomic<uint8_t>[]>
+            users(new std::atomic<uint8_t>[hexes.nodes.size()]());
+        
+        parallel_for(pieces, [&](size_t p) {
+            auto first = hexes.connectivity.begin() +
+                         ptrdiff_t(first_leaf(p) * 8);
+            auto last = hexes.connectivity.begin() +
+                        ptrdiff_t(first_leaf(p + 1) * 8);
+            
+            std::vector<uint64_t> &local = nodes[p];
+            local.assign(first, last);
+            std::sort(local.begin(), local.end());
+            local.erase(std::unique(local.begin(), local.end()), local.end());
+            
+            // Saturates at two, that's all we need to know
+            for(uint64_t n : local) {
+                uint8_t count = users[n].load();
+                while(count < 2 &&
+                      !users[n].compare_exchange_weak(count, uint8_t(count + 1))) { }
+            }
+        });
+        
+        std::string base = path;
+        std::string extension = ".pvtu";
+        if(base.size() > extension.size() &&
+           base.compare(base.size() - extension.size(), extension.size(),
+                        extension) == 0)
+            base.erase(base.size() - extension.size());
+        
+        auto piece_path = [&](size_t p) {
+            return base + "_" + std::to_string(p) + ".vtu";
+        };
+        
+        std::vector<vtu_piece> layout(1);
+        std::atomic<bool> ok(true);
+        
+        parallel_for(pieces, [&](size_t p) {
+            std::vector<uint64_t> const&local = nodes[p];
+            size_t first = first_leaf(p), last = first_leaf(p + 1);
+            
+            vtu_piece piece;
+            piece.number_of_points = local.size();
+            piece.number_of_cells = last - first;
+            
+            std::vector<float> points;
+            std::vector<uint8_t> shared;
+            points.reserve(local.size() * 3);
+            shared.reserve(local.size());
+            for(uint64_t n : local) {
+                glm::u32vec3 position = hexes.position(n);
+                points.push_back(float(position.x));
+                points.push_back(float(position.y));
+                points.push_back(float(position.z));
+                shared.push_back(users[n] > 1);
+            }
+            
+            std::vector<int64_t> connectivity, offsets;
+            std::vector<uint8_t> types(last - first, vtk_hexahedron);
+            std::vector<uint32_t> materials;
+            for(size_t e = first; e < last; ++e) {
+                for(size_t c = 0; c < 8; ++c) {
+                    uint64_t n = hexes.connectivity[e * 8 + c];
+                    connectivity.push_back(int64_t(
+                        std::lower_bound(local.begin(), local.end(), n) -
+                        local.begin()));
+                }
+                offsets.push_back(int64_t(connectivity.size()));
+                materials.push_back(solid[e].material());
+            }
+            
+            std::vector<int64_t> global(local.begin(), local.end());
+            
+            piece.points = make_array("Float32", "Points", 3, points);
+            piece.cells.push_back(
+                make_array("Int64", "connectivity", 1, connectivity));
+            piece.cells.push_back(make_array("Int64", "offsets", 1, offsets));
+            piece.cells.push_back(make_array("UInt8", "types", 1, types));
+            piece.point_data.push_back(make_array("UInt8", "shared", 1,
+                                                  shared));
+            piece.point_data.push_back(make_array("Int64", "GlobalNodeId", 1,
+                                                  global));
+            piece.cell_data.push_back(make_array("UInt32", "material", 1,
+                                                 materials));
+            
+            // Leaf attributes, widened to Float32 if stored as halves
+            for(leaf_attribute const&attribute : _attributes) {
+                std::vector<float> values;
+                values.reserve((last - first) * attribute.components());
+                for(size_t e = first; e < last; ++e)
+                    for(unsigned c = 0; c < attribute.components(); ++c)
+                        values.push_back(attribute.get(leaves[e], c));
+                
+                piece.cell_data.push_back(
+                    make_array("Float32", attribute.name(),
+                               attribute.components(), values));
+            }
+            
+            async_ofstream out(piece_path(p));
+            vtu_writer(out).write(piece);
+            out.close();
+            if(!out)
+                ok = false;
+            
+            // The index only needs names and types, take them from a piece
+            if(p == 0) {
+                for(auto *arrays : { &piece.point_data, &piece.cell_data })
+                    for(data_array &array : *arrays)
+                        array.bytes.clear();
+                layout[0] = std::move(piece);
+            }
+        });
+        
+        std::ofstream index(path);
+        header(index, "PUnstructuredGrid");
+        index << "  <PUnstructuredGrid GhostLevel=\"0\">\n";
+        pvtu_section(index, "PPointData", "", layout[0].point_data);
+        pvtu_section(index, "PCellData", "material", layout[0].cell_data);
+        index << "    <PPoints>\n"
+              << "      <PDataArray type=\"Float32\" "
+              << "NumberOfComponents=\"3\"/>\n"
+              << "    </PPoints>\n";
+        
+        for(size_t p = 0; p < pieces; ++p) {
+            std::string source = piece_path(p);
+            size_t slash = source.find_last_of('/');
+            if(slash != std::string::npos)
+                source.erase(0, slash + 1);
+            
+            index << "    <Piece Source=\"" << source << "\"/>\n";
+        }
+        
+        index << "  </PUnstructuredGrid>\n"
+              << "</VTKFile>\n";
+        index.close();
+        
+        return ok && index;
+    }
+    
+} // namespace details
+} // namespace ocmesh
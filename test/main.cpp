@@ -25,6 +25,9 @@
 
 #include "csg.h"
 #include "octree.h"
+#include "pipeline.h"
+#include "async_file.h"
+#include "compressed_stream.h"
 
 using namespace ocmesh;
 
@@ -41,7 +44,7 @@ int main(int argc, char *argv[])
     std::string outputfile = argv[2];
     
     std::ifstream input(argv[1]);
-    std::ofstream output(argv[2]);
+    async_ofstream output(argv[2]);
 
     
     if(!input) {
@@ -65,13 +68,20 @@ int main(int argc, char *argv[])
     
     std::cout << scene << "\n";
     
-    octree c;
+    // The octree is built and exported at the same time
+#ifdef OCMESH_HAVE_ZLIB
+    std::string gz = ".gz";
+    if(outputfile.size() > gz.size() &&
+       outputfile.compare(outputfile.size() - gz.size(), gz.size(), gz) == 0)
+    {
+        compressed_ostream compressed(output);
+        stream_mesh(scene, 0.01, octree::obj, compressed);
+        compressed.finish();
+    } else
+#endif
+    stream_mesh(scene, 0.01, octree::obj, output);
     
-    c.build(scene, 0.01);
-    
-    std::cout << "Octree built\n";
-    
-    c.mesh(octree::obj, output);
+    std::cout << "Mesh written\n";
     
     return 0;
 }